@@ -1,6 +1,8 @@
 #ifndef AABB_H
 #define AABB_H
 
+#include "stats.h"
+
 class aabb {
 public:
 	interval x, y, z;
@@ -33,6 +35,7 @@ public:
 	}
 
 	bool hit(const ray& r, interval ray_t) const {
+		RT_STAT(STAT_AABB_TESTS);
 		const point3& ray_orig = r.origin();
 		const vec3& ray_dir = r.direction();
 		for (int axis = 0; axis < 3; axis++) {
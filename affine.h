@@ -0,0 +1,165 @@
+#ifndef AFFINE_H
+#define AFFINE_H
+
+#include "aabb.h"
+
+class affine {
+public:
+	// Row-major 3x4 matrix: the left 3x3 block is the linear part, the last column is the
+	// translation. The implicit fourth row is (0, 0, 0, 1).
+	double m[3][4];
+
+	affine() : m{ {1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0} } {}
+
+	static affine translation(const vec3& offset) {
+		affine a;
+		a.m[0][3] = offset.x();
+		a.m[1][3] = offset.y();
+		a.m[2][3] = offset.z();
+		return a;
+	}
+
+	static affine scaling(const vec3& s) {
+		affine a;
+		a.m[0][0] = s.x();
+		a.m[1][1] = s.y();
+		a.m[2][2] = s.z();
+		return a;
+	}
+
+	static affine rotation_x(double angle) {
+		auto rad_angle = degrees_to_radians(angle);
+		auto c = std::cos(rad_angle), s = std::sin(rad_angle);
+		affine a;
+		a.m[1][1] = c; a.m[1][2] = -s;
+		a.m[2][1] = s; a.m[2][2] = c;
+		return a;
+	}
+
+	static affine rotation_y(double angle) {
+		// Same handedness as rotate_y: positive angles turn +x towards -z.
+		auto rad_angle = degrees_to_radians(angle);
+		auto c = std::cos(rad_angle), s = std::sin(rad_angle);
+		affine a;
+		a.m[0][0] = c;  a.m[0][2] = s;
+		a.m[2][0] = -s; a.m[2][2] = c;
+		return a;
+	}
+
+	static affine rotation_z(double angle) {
+		auto rad_angle = degrees_to_radians(angle);
+		auto c = std::cos(rad_angle), s = std::sin(rad_angle);
+		affine a;
+		a.m[0][0] = c; a.m[0][1] = -s;
+		a.m[1][0] = s; a.m[1][1] = c;
+		return a;
+	}
+
+	point3 transform_point(const point3& p) const {
+		return point3(
+			m[0][0] * p.x() + m[0][1] * p.y() + m[0][2] * p.z() + m[0][3],
+			m[1][0] * p.x() + m[1][1] * p.y() + m[1][2] * p.z() + m[1][3],
+			m[2][0] * p.x() + m[2][1] * p.y() + m[2][2] * p.z() + m[2][3]
+		);
+	}
+
+	vec3 transform_vector(const vec3& v) const {
+		return vec3(
+			m[0][0] * v.x() + m[0][1] * v.y() + m[0][2] * v.z(),
+			m[1][0] * v.x() + m[1][1] * v.y() + m[1][2] * v.z(),
+			m[2][0] * v.x() + m[2][1] * v.y() + m[2][2] * v.z()
+		);
+	}
+
+	vec3 transform_vector_transposed(const vec3& v) const {
+		// Multiplies by the transpose of the linear part. Called on the inverse matrix this
+		// maps surface normals, which transform by the inverse transpose.
+		return vec3(
+			m[0][0] * v.x() + m[1][0] * v.y() + m[2][0] * v.z(),
+			m[0][1] * v.x() + m[1][1] * v.y() + m[2][1] * v.z(),
+			m[0][2] * v.x() + m[1][2] * v.y() + m[2][2] * v.z()
+		);
+	}
+
+	aabb transform_box(const aabb& bbox) const {
+		// Returns the bounds of all eight transformed corners, on every axis.
+		point3 min(+infinity, +infinity, +infinity);
+		point3 max(-infinity, -infinity, -infinity);
+
+		for (int i = 0; i < 2; i++) {
+			for (int j = 0; j < 2; j++) {
+				for (int k = 0; k < 2; k++) {
+					auto corner = transform_point(point3(
+						i ? bbox.x.max : bbox.x.min,
+						j ? bbox.y.max : bbox.y.min,
+						k ? bbox.z.max : bbox.z.min
+					));
+					for (int c = 0; c < 3; c++) {
+						min[c] = std::fmin(corner[c], min[c]);
+						max[c] = std::fmax(corner[c], max[c]);
+					}
+				}
+			}
+		}
+		return aabb(min, max);
+	}
+
+	bool is_translation() const {
+		return m[0][0] == 1 && m[0][1] == 0 && m[0][2] == 0
+			&& m[1][0] == 0 && m[1][1] == 1 && m[1][2] == 0
+			&& m[2][0] == 0 && m[2][1] == 0 && m[2][2] == 1;
+	}
+
+	bool is_rigid(double tolerance = 1e-9) const {
+		// True for rotations and translations: the rows of the linear part are orthonormal
+		// and the handedness is preserved.
+		for (int i = 0; i < 3; i++) {
+			for (int j = 0; j < 3; j++) {
+				double d = m[i][0] * m[j][0] + m[i][1] * m[j][1] + m[i][2] * m[j][2];
+				if (std::fabs(d - (i == j ? 1 : 0)) > tolerance) return false;
+			}
+		}
+		return determinant() > 0;
+	}
+
+	double determinant() const {
+		return m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+			 - m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+			 + m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+	}
+
+	affine inverse() const {
+		// Inverts the linear part by its adjugate, then maps the translation through it.
+		auto inv_det = 1.0 / determinant();
+		affine a;
+		a.m[0][0] =  (m[1][1] * m[2][2] - m[1][2] * m[2][1]) * inv_det;
+		a.m[0][1] = -(m[0][1] * m[2][2] - m[0][2] * m[2][1]) * inv_det;
+		a.m[0][2] =  (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * inv_det;
+		a.m[1][0] = -(m[1][0] * m[2][2] - m[1][2] * m[2][0]) * inv_det;
+		a.m[1][1] =  (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * inv_det;
+		a.m[1][2] = -(m[0][0] * m[1][2] - m[0][2] * m[1][0]) * inv_det;
+		a.m[2][0] =  (m[1][0] * m[2][1] - m[1][1] * m[2][0]) * inv_det;
+		a.m[2][1] = -(m[0][0] * m[2][1] - m[0][1] * m[2][0]) * inv_det;
+		a.m[2][2] =  (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * inv_det;
+
+		auto t = a.transform_vector(vec3(m[0][3], m[1][3], m[2][3]));
+		a.m[0][3] = -t.x();
+		a.m[1][3] = -t.y();
+		a.m[2][3] = -t.z();
+		return a;
+	}
+};
+
+inline affine operator*(const affine& a, const affine& b) {
+	// Composes two transforms: (a * b) applies b first, then a.
+	affine r;
+	for (int i = 0; i < 3; i++) {
+		for (int j = 0; j < 4; j++) {
+			r.m[i][j] = a.m[i][0] * b.m[0][j] + a.m[i][1] * b.m[1][j] + a.m[i][2] * b.m[2][j];
+		}
+		r.m[i][3] += a.m[i][3];
+	}
+	return r;
+}
+
+#endif // !AFFINE_H
@@ -0,0 +1,108 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include "rtweekend.h"
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+class arena {
+public:
+	// Owns scene objects (primitives, materials, textures) in blocks of one type each, so
+	// objects of a type are contiguous in memory, and frees them all at once. make() returns
+	// a non-owning shared_ptr handle: it has no control block, copying it counts nothing, and
+	// it stays valid exactly as long as the arena. Keep the arena alive until rendering ends.
+	// Handles cannot own their objects, since arena objects refer to each other and would keep
+	// the arena alive in a cycle; and their use_count() is 0, so nothing should count on it.
+	arena() = default;
+	arena(const arena&) = delete;
+	arena& operator=(const arena&) = delete;
+
+	template <typename T, typename... Args>
+	shared_ptr<T> make(Args&&... args) {
+		T* object = pool_for<T>().create(std::forward<Args>(args)...);
+		// Aliasing an empty shared_ptr gives a non-null pointer without ownership.
+		return shared_ptr<T>(shared_ptr<T>(), object);
+	}
+
+	size_t object_count() const {
+		size_t count = 0;
+		for (const auto& p : pools) if (p) count += p->size();
+		return count;
+	}
+
+	size_t memory_usage() const {
+		size_t bytes = 0;
+		for (const auto& p : pools) if (p) bytes += p->memory_usage();
+		return bytes;
+	}
+
+private:
+	class pool_base {
+	public:
+		virtual ~pool_base() = default;
+		virtual size_t size() const = 0;
+		virtual size_t memory_usage() const = 0;
+	};
+
+	template <typename T>
+	class pool : public pool_base {
+	public:
+		~pool() override {
+			for (size_t b = blocks.size(); b-- > 0;) {
+				size_t count = b + 1 == blocks.size() ? used : block_size;
+				for (size_t i = count; i-- > 0;) blocks[b][i].~T();
+				std::allocator<T>().deallocate(blocks[b], block_size);
+			}
+		}
+
+		template <typename... Args>
+		T* create(Args&&... args) {
+			if (blocks.empty() || used == block_size) {
+				blocks.push_back(std::allocator<T>().allocate(block_size));
+				used = 0;
+			}
+			T* object = new (blocks.back() + used) T(std::forward<Args>(args)...);
+			used++;
+			return object;
+		}
+
+		size_t size() const override {
+			return blocks.empty() ? 0 : (blocks.size() - 1) * block_size + used;
+		}
+
+		size_t memory_usage() const override {
+			return blocks.size() * block_size * sizeof(T);
+		}
+
+	private:
+		// Blocks never move once allocated, so handles stay valid as the pool grows.
+		static const size_t block_size = 4096;
+		std::vector<T*> blocks;
+		size_t used = 0;
+	};
+
+	std::vector<std::unique_ptr<pool_base>> pools;	// Indexed by type_index<T>()
+
+	static size_t next_type_index() {
+		static size_t next = 0;
+		return next++;
+	}
+
+	template <typename T>
+	static size_t type_index() {
+		static const size_t index = next_type_index();
+		return index;
+	}
+
+	template <typename T>
+	pool<T>& pool_for() {
+		auto index = type_index<T>();
+		if (index >= pools.size()) pools.resize(index + 1);
+		if (!pools[index]) pools[index] = std::make_unique<pool<T>>();
+		return static_cast<pool<T>&>(*pools[index]);
+	}
+};
+
+#endif // !ARENA_H
@@ -0,0 +1,123 @@
+#ifndef BOX_H
+#define BOX_H
+
+#include "affine.h"
+#include "hittable.h"
+
+class box : public hittable {
+public:
+	// Axis-aligned box spanned by the two opposite vertices a & b.
+	box(const point3& a, const point3& b, shared_ptr<material> mat) : mat(mat), oriented(false) {
+		set_extent(a, b);
+		bbox = aabb(min, max);
+	}
+
+	// Oriented box: the box spanned by a & b, then moved by `placement`. The placement must be
+	// rigid (rotations and translations only).
+	box(const point3& a, const point3& b, const affine& placement, shared_ptr<material> mat)
+		: mat(mat), oriented(true), local_to_world(placement), world_to_local(placement.inverse())
+	{
+		set_extent(a, b);
+		bbox = placement.transform_box(aabb(min, max));
+	}
+
+	bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+		RT_STAT(STAT_BOX_TESTS);
+		point3 origin = r.origin();
+		vec3 direction = r.direction();
+		if (oriented) {
+			origin = world_to_local.transform_point(origin);
+			direction = world_to_local.transform_vector(direction);
+		}
+
+		// Single slab test, remembering which axis bounds the entry and exit points.
+		double t_near = -infinity, t_far = infinity;
+		int near_axis = 0, far_axis = 0;
+		for (int axis = 0; axis < 3; axis++) {
+			const double invdir = 1 / direction[axis];
+			auto t0 = (min[axis] - origin[axis]) * invdir;
+			auto t1 = (max[axis] - origin[axis]) * invdir;
+			if (t0 > t1) std::swap(t0, t1);
+			if (t0 > t_near) { t_near = t0; near_axis = axis; }
+			if (t1 < t_far) { t_far = t1; far_axis = axis; }
+		}
+		if (t_near > t_far) return false;
+
+		// Rays starting inside the box hit its far side.
+		double t;
+		int axis;
+		bool exiting;
+		if (ray_t.surrounds(t_near)) { t = t_near; axis = near_axis; exiting = false; }
+		else if (ray_t.surrounds(t_far)) { t = t_far; axis = far_axis; exiting = true; }
+		else return false;
+
+		// The entry face faces against the ray, the exit face along it.
+		bool positive_side = (direction[axis] > 0) == exiting;
+		vec3 outward_normal(0, 0, 0);
+		outward_normal[axis] = positive_side ? 1 : -1;
+
+		face_uv(origin + t * direction, axis, positive_side, rec.u, rec.v, rec.dpdu, rec.dpdv);
+		if (oriented) {
+			rec.dpdu = local_to_world.transform_vector(rec.dpdu);
+			rec.dpdv = local_to_world.transform_vector(rec.dpdv);
+		}
+
+		rec.t = t;
+		rec.p = r.at(t);
+		rec.mat = mat.get();
+		rec.set_face_normal(r, oriented ? local_to_world.transform_vector(outward_normal) : outward_normal);
+		return true;
+	}
+
+	aabb bounding_box() const override { return bbox; }
+
+	friend class compiled_scene;
+	friend class scene;
+private:
+	point3 min, max;
+	vec3 inv_size;
+	shared_ptr<material> mat;
+	aabb bbox;
+	bool oriented;
+	affine local_to_world;
+	affine world_to_local;
+
+	void set_extent(const point3& a, const point3& b) {
+		// Construct the two opposite vertices with the minimum and maximum coordinates.
+		min = point3(std::fmin(a.x(), b.x()), std::fmin(a.y(), b.y()), std::fmin(a.z(), b.z()));
+		max = point3(std::fmax(a.x(), b.x()), std::fmax(a.y(), b.y()), std::fmax(a.z(), b.z()));
+		auto size = max - min;
+		inv_size = vec3(1 / size.x(), 1 / size.y(), 1 / size.z());
+	}
+
+	void face_uv(const point3& p, int axis, bool positive_side, double& u, double& v,
+				 vec3& dpdu, vec3& dpdv) const {
+		// Per-face texture coordinates in [0,1], laid out like the six quads the box used to
+		// be built from, and their derivatives in box space.
+		auto x = (p.x() - min.x()) * inv_size.x();
+		auto y = (p.y() - min.y()) * inv_size.y();
+		auto z = (p.z() - min.z()) * inv_size.z();
+		auto size = max - min;
+
+		if (axis == 0) {
+			u = positive_side ? 1 - z : z;	// right : left
+			v = y;
+			dpdu = vec3(0, 0, positive_side ? -size.z() : size.z());
+			dpdv = vec3(0, size.y(), 0);
+		}
+		else if (axis == 1) {
+			u = x;
+			v = positive_side ? 1 - z : z;	// top : bottom
+			dpdu = vec3(size.x(), 0, 0);
+			dpdv = vec3(0, 0, positive_side ? -size.z() : size.z());
+		}
+		else {
+			u = positive_side ? x : 1 - x;	// front : back
+			v = y;
+			dpdu = vec3(positive_side ? size.x() : -size.x(), 0, 0);
+			dpdv = vec3(0, size.y(), 0);
+		}
+	}
+};
+
+#endif // !BOX_H
@@ -2,6 +2,7 @@
 #define BVH_H
 
 #include "aabb.h"
+#include "flat_bvh.h"
 #include "hittable.h"
 #include "hittable_list.h"
 
@@ -59,6 +60,7 @@ public:
 	}
 
 	bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+		RT_STAT(STAT_BVH_NODES);
 		if (!bbox.hit(r, ray_t)) return false;
 
 		bool hit_left = left->hit(r, ray_t, rec);
@@ -69,9 +71,55 @@ public:
 
 	aabb bounding_box() const override { return bbox; }
 
+	friend class compiled_scene;
+	friend class scene;
 private:
 	shared_ptr<hittable> left;
 	shared_ptr<hittable> right;
 	aabb bbox;
 };
+
+class bvh_tree : public hittable {
+public:
+	// Binned-SAH BVH over arbitrary hittables, stored as a flat node array instead of a
+	// tree of bvh_nodes. Objects far larger than their neighbours (ground spheres, walls) are
+	// split off near the root instead of inflating every node on their side of a median.
+	bvh_tree(const hittable_list& list) {
+		std::vector<flat_bvh::build_prim> prims(list.objects.size());
+		for (size_t i = 0; i < prims.size(); i++) {
+			auto object_box = list.objects[i]->bounding_box();
+			prims[i].bounds.grow(object_box);
+			prims[i].index = uint32_t(i);
+			bbox = aabb(bbox, object_box);
+		}
+		for (auto index : bvh.build(std::move(prims), max_leaf_size))
+			objects.push_back(list.objects[index]);
+	}
+
+	bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+		double closest = ray_t.max;
+		bool hit_anything = false;
+		bvh.traverse(r, ray_t.min, closest, [&](uint32_t first, uint32_t count) {
+			for (auto i = first; i < first + count; i++) {
+				if (objects[i]->hit(r, interval(ray_t.min, closest), rec)) {
+					hit_anything = true;
+					closest = rec.t;
+				}
+			}
+		});
+		return hit_anything;
+	}
+
+	aabb bounding_box() const override { return bbox; }
+
+	friend class compiled_scene;
+	friend class scene;
+private:
+	static const int max_leaf_size = 2;
+
+	std::vector<shared_ptr<hittable>> objects;	// In leaf order
+	flat_bvh bvh;
+	aabb bbox = aabb::empty;
+};
+
 #endif
\ No newline at end of file
@@ -1,13 +1,50 @@
 #ifndef CAMERA_H
 #define CAMERA_H
 
+#include "compiled_scene.h"
+#include "denoise.h"
+#include "heatmap.h"
 #include "hittable.h"
 #include "material.h"
 #include "pdf.h"
+#include "preview.h"
+#include "scene.h"
+#include "stats.h"
+#include "trace.h"
 #include <vector>
 #include <omp.h>
 
 #include <chrono>
+#include <iostream>
+#include <numeric>
+
+enum progressive_mode {
+	PROGRESSIVE_OFF,		// Every pixel takes all its samples at once
+	PROGRESSIVE_SINGLE,		// Passes of one sample per pixel over the whole frame
+	PROGRESSIVE_DOUBLING	// Passes of 1, 1, 2, 4, ... samples per pixel
+};
+
+struct pixel_rect {
+	// Pixels [x0, x1) x [y0, y1) of an image; empty if either range is.
+	int x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+
+	bool empty() const { return x1 <= x0 || y1 <= y0; }
+};
+
+struct render_stats {
+	// Timings and ray counts of the last camera::render.
+	double build_seconds = 0;	// Compiling the scene: flattening it and building its BVH
+	double render_seconds = 0;
+	double denoise_seconds = 0;	// Finding the denoiser's features and filtering
+	double output_seconds = 0;	// Writing the image
+	size_t samples = 0;			// Camera samples, one primary ray each
+	size_t primary_rays = 0;
+	size_t secondary_rays = 0;	// Rays scattered at surfaces and in volumes
+	int threads = 1;
+	int samples_per_pixel = 0;	// Taken, which a time budget may make fewer than asked for
+	double noise = 0;			// Estimated RMS standard error of the pixels' luminance
+	double relative_noise = 0;	// The same, over the mean pixel luminance
+};
 
 class camera {
 public:
@@ -25,44 +62,223 @@ public:
 	double defocus_angle = 0;			// Variation angle of rays through each pixel
 	double focus_dist = 10;				// Distance from camera lookfrom point to plane of perfect focus
 
+	bool   devirtualize = false;		// Render from a compiled_scene instead of the virtual classes
+	bool   probe_compile = false;		// Times ray queries in the world before and after compiling it
+										// and logs both; slow on unaccelerated worlds, and left out of
+										// all timings and the time budget
+
+	std::ostream* output = &std::cout;	// Where the PPM image goes; null renders without output
+	render_stats stats;					// Filled in by render()
+	std::vector<color> pixels;			// Linear colors of the last render, row by row
+	std::string heatmap_prefix;			// If set, also writes per-pixel cost heatmaps named after it
+
+	progressive_mode progressive = PROGRESSIVE_OFF;
+	std::string preview_path;			// If set, progressive renders write their image so far here
+	double preview_interval = 5;		// Seconds between preview writes
+	double time_budget = 0;				// If set, seconds to build and sample the image in; samples_per_pixel
+										// is then an upper bound
+	pixel_rect crop;					// If set, renders and outputs only these pixels of the frame
+	int stream_rows = 0;				// If set, renders bands of this many rows and writes each when
+										// done, so memory does not grow with the image; `pixels` stays empty
+	bool denoise = false;				// Filters the image at the end, guided by first-hit features
+
+	int frame_height() const {
+		// The full frame's height, at least 1.
+		return std::max(1, int(image_width / aspect_ratio));
+	}
+
+	void crop_to_tiles(int tile_size, int tx0, int ty0, int tx1, int ty1) {
+		// Crops to tiles [tx0, tx1) x [ty0, ty1) of a grid of tile_size squares from the top left
+		// corner, for splitting a frame between jobs. Edge tiles are clipped to the frame; a
+		// range entirely past it renders nothing.
+		crop = { tx0 * tile_size, ty0 * tile_size, tx1 * tile_size, ty1 * tile_size };
+	}
 
 	void render(const hittable_list& world, const hittable_list& lights) {
-		initialize();
-		auto start = std::chrono::steady_clock::now();
-		std::cout << "P3\n" << image_width << ' ' << image_height << "\n255\n";
-		std::vector<std::vector<color>> img(image_width, std::vector<color>(image_height, color(0, 0, 0)));
-		#pragma omp parallel shared(img)
+		stats = render_stats();
+		pixels.clear();
+		if (!initialize()) return;
+		stats.threads = omp_get_max_threads();
+		auto render_start = std::chrono::steady_clock::now();
+		auto phase_start = render_start;
+		auto seconds_since = [](std::chrono::steady_clock::time_point start) {
+			return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		};
+		auto end_phase = [&](double& seconds) {
+			auto now = std::chrono::steady_clock::now();
+			seconds = std::chrono::duration<double>(now - phase_start).count();
+			phase_start = now;
+		};
+
+		scene compiled(world, lights);
+		std::unique_ptr<compiled_scene> closed;
 		{
-		int id = omp_get_thread_num();
-		for (int j = 0; j < image_height; j++) {
-			if (id == 0) std::clog << "\rProgress: " << (j * 100 / image_height) << '%' << std::flush;
-			#pragma omp for
-			for (int i = 0; i < image_width; i++) {
-				color pixel_color(0, 0, 0);
-				for (int s_j = 0; s_j < sqrt_spp; s_j++) {
-					for (int s_i = 0; s_i < sqrt_spp; s_i++) {
-						ray r = get_ray(i, j, s_i, s_j);
-						pixel_color += ray_color(r, max_depth, world, lights);
-					}
-				}
-				img[i][j] = pixel_color;
+			trace_scope scope("compile scene", "build");
+			compiled.compile();
+			if (devirtualize) {
+				closed = std::make_unique<compiled_scene>(compiled.world, compiled.lights);
+				closed->report(std::clog);
 			}
 		}
+		end_phase(stats.build_seconds);
+
+		if (probe_compile) {
+			auto rays = probe_rays();
+			std::clog << "Ray cost " << scene::probe_ray_cost(world, rays) << " ns before compiling, "
+					  << scene::probe_ray_cost(compiled.world, rays) << " ns after\n";
+			// Moves the render's clocks past the probe, so it counts in no phase and no budget.
+			auto now = std::chrono::steady_clock::now();
+			render_start += now - phase_start;
+			phase_start = now;
+		}
+
+		// Without streaming, the region is a single band of rows.
+		bool streaming = stream_rows > 0 && output;
+		int band_rows = streaming ? std::min(stream_rows, region_height) : region_height;
+		std::vector<std::vector<color>> img(region_width, std::vector<color>(band_rows, color(0, 0, 0)));
+		std::vector<double> luminance_squares(size_t(region_width) * band_rows);	// Row by row
+		size_t rays = 0;
+		std::unique_ptr<cost_heatmaps> heatmaps;
+		if (!heatmap_prefix.empty()) heatmaps = std::make_unique<cost_heatmaps>(region_width, region_height);
+		auto render_strata = [&](const std::vector<int>& strata, int first_row, int rows) {
+			if (closed)
+				return render_pixels(img, luminance_squares, heatmaps.get(), strata, first_row, rows, [&](const ray& r) { return closed->ray_color(r, max_depth, background); });
+			return render_pixels(img, luminance_squares, heatmaps.get(), strata, first_row, rows, [&](const ray& r) { return ray_color(r, max_depth, compiled.world, compiled.lights); });
+		};
+		// A time budget needs passes to stop between; doubling ones keep their count low. Streamed
+		// bands are final once written, so they take all their samples in one pass.
+		auto mode = (time_budget > 0 && progressive == PROGRESSIVE_OFF) ? PROGRESSIVE_DOUBLING : progressive;
+		if (streaming && denoise)
+			std::clog << "Streaming output is not denoised; the denoiser needs the whole image\n";
+		if (streaming && (mode != PROGRESSIVE_OFF || time_budget > 0)) {
+			std::clog << "Streaming output renders in one pass; the progressive mode and time budget are ignored\n";
+			mode = PROGRESSIVE_OFF;
+		}
+		std::unique_ptr<preview_writer> preview;
+		if (mode != PROGRESSIVE_OFF && !preview_path.empty())
+			preview = std::make_unique<preview_writer>(preview_path, preview_interval);
+
+		stat_registry::reset();		// Count rendering only, not the compile's probe rays
+		auto order = stratum_order(mode);
+		size_t samples_done = 0;
+		noise_sums noise;
+		double stream_seconds = 0;	// Writing streamed bands
+		if (streaming) {
+			samples_done = order.size();
+			pixel_samples_scale = 1.0 / samples_done;
+			write_header(*output);
+			for (int first_row = 0; first_row < region_height; first_row += band_rows) {
+				auto rows = std::min(band_rows, region_height - first_row);
+				if (first_row > 0) {
+					for (auto& column : img) std::fill(column.begin(), column.end(), color(0, 0, 0));
+					std::fill(luminance_squares.begin(), luminance_squares.end(), 0.0);
+				}
+				{
+					trace_scope scope("band", "render", "first_row", region_y + first_row);
+					rays += render_strata(order, first_row, rows);
+				}
+				add_noise(img, luminance_squares, rows, samples_done, noise);
+
+				auto write_start = std::chrono::steady_clock::now();
+				trace_scope scope("write band", "output", "first_row", region_y + first_row);
+				write_rows(*output, img, rows);
+				output->flush();
+				stream_seconds += seconds_since(write_start);
+			}
 		}
-		for (int j = 0; j < image_height; j++) {
-			//std::clog << "\rScanlines remaining: " << (image_height - j) << ' ' << std::flush;
-			for (int i = 0; i < image_width; i++) {
-				write_color(std::cout, pixel_samples_scale * img[i][j]);
+		else {
+			for (int pass = 1; samples_done < order.size(); pass++) {
+				auto size = pass_size(mode, samples_done, order.size());
+				if (time_budget > 0 && samples_done > 0) {
+					// Every pixel gets the same samples, so passes shrink to what the time left
+					// affords at the rate measured so far, and none starts that could not finish.
+					auto seconds_per_sample = seconds_since(phase_start) / samples_done;
+					auto remaining = time_budget - seconds_since(render_start);
+					size = std::min(size, size_t(std::max(0.0, remaining / seconds_per_sample)));
+					if (size == 0) break;
+				}
+				std::vector<int> strata(order.begin() + samples_done, order.begin() + samples_done + size);
+				trace_scope scope("pass", "render", "samples", int64_t(size));
+				rays += render_strata(strata, 0, region_height);
+				samples_done += size;
+				if (mode == PROGRESSIVE_OFF) continue;
+				std::clog << "\rPass " << pass << ": " << samples_done << " of " << order.size() << " samples per pixel\n";
+				if (preview && samples_done < order.size() && preview->due()) {
+					std::vector<color> snapshot(size_t(region_width) * region_height);
+					for (int j = 0; j < region_height; j++)
+						for (int i = 0; i < region_width; i++)
+							snapshot[size_t(j) * region_width + i] = img[i][j] / double(samples_done);
+					preview->write(region_width, std::move(snapshot));
+				}
 			}
+			pixel_samples_scale = 1.0 / samples_done;
+			add_noise(img, luminance_squares, region_height, samples_done, noise);
+		}
+		stats.samples_per_pixel = int(samples_done);
+		stats.samples = size_t(region_width) * region_height * samples_done;
+		stats.primary_rays = stats.samples;
+		stats.secondary_rays = rays - std::min(rays, stats.primary_rays);
+		stats.noise = std::sqrt(noise.variance / noise.pixels);
+		stats.relative_noise = noise.mean > 0 ? stats.noise / (noise.mean / noise.pixels) : 0;
+		end_phase(stats.render_seconds);
+		stats.render_seconds -= stream_seconds;
+
+		// Streamed renders keep no image.
+		pixels.clear();
+		if (!streaming) {
+			pixels.resize(size_t(region_width) * region_height);
+			for (int j = 0; j < region_height; j++)
+				for (int i = 0; i < region_width; i++)
+					pixels[size_t(j) * region_width + i] = pixel_samples_scale * img[i][j];
+		}
+
+		if (denoise && !streaming) {
+			trace_scope scope("denoise", "denoise");
+			// A single sample per pixel says nothing of its variance; the neighbors stand in.
+			std::vector<double> variance(pixels.size());
+			if (samples_done < 2)
+				variance = atrous_denoiser::spatial_variance(region_width, region_height, pixels);
+			else
+				for (int j = 0; j < region_height; j++)
+					for (int i = 0; i < region_width; i++)
+						variance[size_t(j) * region_width + i]
+							= mean_variance(img[i][j], luminance_squares[size_t(j) * region_width + i], double(samples_done));
+			pixels = atrous_denoiser().denoise(region_width, region_height, pixels, variance, first_hit_features(compiled.world));
 		}
-		auto end = std::chrono::steady_clock::now();
-		auto diff = duration_cast<std::chrono::milliseconds>(end - start);
+		end_phase(stats.denoise_seconds);
+
+		if (output && !streaming) {
+			trace_scope scope("write image", "output");
+			write_header(*output);
+			for (const auto& p : pixels) write_color(*output, p);
+			output->flush();
+		}
+		if (heatmaps) {
+			trace_scope scope("write heatmaps", "output");
+			heatmaps->write(heatmap_prefix, std::clog);
+		}
+		end_phase(stats.output_seconds);
+		stats.output_seconds += stream_seconds;
+
 		std::clog << "\rDone.                        \n";
-		std::clog << "\r" << diff.count() / 1000 << "s \n";
+		std::clog << "Build " << stats.build_seconds << " s, render " << stats.render_seconds << " s, ";
+		if (denoise) std::clog << "denoise " << stats.denoise_seconds << " s, ";
+		std::clog << "output "
+				  << stats.output_seconds << " s; " << (stats.primary_rays + stats.secondary_rays) / stats.render_seconds / 1e6
+				  << " M rays/s on " << stats.threads << " threads\n";
+		std::clog << stats.samples_per_pixel << " samples per pixel";
+		if (time_budget > 0)
+			std::clog << " (of " << sqrt_spp * sqrt_spp << ") in a budget of " << time_budget << " s";
+		std::clog << "; estimated noise " << stats.noise << " (" << 100 * stats.relative_noise << "% of mean luminance)\n";
+#ifdef RT_ENABLE_STATS
+		stat_registry::print(stat_registry::totals(), std::clog);
+#endif
 	}
 
 private:
 	int    image_height;   // Rendered image height
+	int    region_x, region_y;				// Top left pixel of the rendered region
+	int    region_width, region_height;		// Size of the rendered region, the frame unless cropped
 	double pixel_samples_scale;  // Color scale factor for a sum of pixel samples
 	int    sqrt_spp;             // Square root of number of samples per pixel
 	double recip_sqrt_spp;       // 1 / sqrt_spp
@@ -73,11 +289,79 @@ private:
 	vec3   u, v, w;		   // Camera frame basis vectors
 	vec3   defocus_disk_u; // Defocus disk horizontal radius
 	vec3   defocus_disk_v; // Defocus disk vertical radius
+	double cone_spread;    // Growth of a camera ray's footprint per unit distance
+
+	template <typename F>
+	size_t render_pixels(std::vector<std::vector<color>>& img, std::vector<double>& luminance_squares,
+						 cost_heatmaps* heatmaps, const std::vector<int>& strata, int first_row, int rows,
+						 F&& sample_color) {
+		// Adds a sample in each of the given strata to every pixel of rows [first_row, first_row
+		// + rows) of the region, indexed from the band's top left corner in `img` and
+		// `luminance_squares` and from the region's in `heatmaps`. sample_color(ray) traces one
+		// path. Also adds the squares of the samples' luminances to `luminance_squares`, for the
+		// noise estimate, and records each pixel's cost in `heatmaps` if there are any. Returns
+		// the number of rays traced. Each thread's share of a row is a trace event; the wait for
+		// the others at the end of the row shows as the gap after it.
+		size_t rays = 0;
+		#pragma omp parallel shared(img) reduction(+:rays)
+		{
+		auto rays_before = rays_traced;
+		int id = omp_get_thread_num();
+		for (int j = first_row; j < first_row + rows; j++) {
+			if (id == 0) std::clog << "\rProgress: " << (j * 100 / region_height) << '%' << std::flush;
+			{
+			trace_scope scope("row", "render", "row", region_y + j);
+			#pragma omp for nowait
+			for (int i = 0; i < region_width; i++) {
+				std::chrono::steady_clock::time_point pixel_start;
+				cost_heatmaps::work work_start;
+				if (heatmaps) {
+					pixel_start = std::chrono::steady_clock::now();
+					work_start = cost_heatmaps::thread_work();
+				}
+				color pixel_color(0, 0, 0);
+				double pixel_squares = 0;
+				for (auto s : strata) {
+					ray r = get_ray(region_x + i, region_y + j, s % sqrt_spp, s / sqrt_spp);
+					RT_STAT(STAT_CAMERA_RAYS);
+					auto path_start = rays_traced;
+					auto sample = sample_color(r);
+					RT_STAT_PATH(rays_traced - path_start);
+					pixel_color += sample;
+					pixel_squares += luminance(sample) * luminance(sample);
+				}
+				img[i][j - first_row] += pixel_color;
+				luminance_squares[size_t(j - first_row) * region_width + i] += pixel_squares;
+				if (heatmaps) {
+					auto pixel_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - pixel_start);
+					heatmaps->record(i, j, pixel_seconds.count(), work_start, cost_heatmaps::thread_work());
+				}
+			}
+			}
+			#pragma omp barrier
+		}
+		rays += rays_traced - rays_before;
+		}
+		return rays;
+	}
 
-	void initialize() {
+	bool initialize() {
+		// Returns false, rendering nothing, if the crop misses the frame.
 		// Calculate the image height, and ensure that it's at least 1.
-		image_height = int(image_width / aspect_ratio);
-		image_height = (image_height < 1) ? 1 : image_height;
+		image_height = frame_height();
+
+		// The rendered region: the crop, clipped to the frame, or else the whole frame.
+		auto region = crop;
+		if (region.empty()) region = { 0, 0, image_width, image_height };
+		region_x = std::max(region.x0, 0);
+		region_y = std::max(region.y0, 0);
+		region_width = std::min(region.x1, image_width) - region_x;
+		region_height = std::min(region.y1, image_height) - region_y;
+		if (region_width <= 0 || region_height <= 0) {
+			std::cerr << "ERROR: Crop " << region.x0 << ',' << region.y0 << " to " << region.x1 << ',' << region.y1
+					  << " lies outside the " << image_width << 'x' << image_height << " frame.\n";
+			return false;
+		}
 
 		sqrt_spp = int(std::sqrt(samples_per_pixel));
 		pixel_samples_scale = 1.0 / (sqrt_spp * sqrt_spp);
@@ -113,6 +397,145 @@ private:
 		auto defocus_radius = focus_dist * std::tan(degrees_to_radians(defocus_angle/2.0));
 		defocus_disk_u = u * defocus_radius;
 		defocus_disk_v = v * defocus_radius;
+
+		// Each sample covers its stratum of the pixel; past 8x8 strata, keep some filtering
+		// so that texture lookups stay coherent.
+		cone_spread = pixel_delta_u.length() / focus_dist * std::fmax(0.125, recip_sqrt_spp);
+		return true;
+	}
+
+	struct noise_sums {
+		double variance = 0;	// Of the pixels' mean luminance
+		double mean = 0;		// Luminance
+		double pixels = 0;
+	};
+
+	void add_noise(const std::vector<std::vector<color>>& img, const std::vector<double>& luminance_squares,
+				   int rows, size_t samples, noise_sums& sums) const {
+		// Adds the first `rows` rows to the sums, with the standard error of each pixel's mean
+		// luminance estimated from the variance of its samples. Treating the stratified samples
+		// as independent overestimates it somewhat.
+		auto n = double(samples);
+		for (int j = 0; j < rows; j++) {
+			for (int i = 0; i < region_width; i++) {
+				sums.pixels++;
+				auto variance = mean_variance(img[i][j], luminance_squares[size_t(j) * region_width + i], n);
+				if (n < 2 || !std::isfinite(variance)) continue;
+				sums.variance += variance;
+				sums.mean += luminance(img[i][j]) / n;
+			}
+		}
+	}
+
+	static double mean_variance(const color& sum, double luminance_squares, double n) {
+		// The variance of the mean luminance of n samples, from their sum and sum of squares.
+		if (n < 2) return 0;
+		auto l = luminance(sum) / n;
+		return std::max(0.0, luminance_squares / n - l * l) / (n - 1);
+	}
+
+	feature_buffers first_hit_features(const hittable_list& world) const {
+		// Albedo, normal and depth where the region's pixels first hit the scene, from rays
+		// through the centers of each pixel's quarters: four from the lens center, or with
+		// defocus blur eight from fixed points of the lens, so that the features blur where the
+		// image does. They take no random numbers, so the rendered samples are unchanged.
+		feature_buffers f;
+		size_t n = size_t(region_width) * region_height;
+		f.albedo.resize(n);
+		f.normal.resize(n);
+		f.depth.resize(n);
+		static const interval unit(0, 1);
+		auto background_albedo = color(unit.clamp(background.x()), unit.clamp(background.y()), unit.clamp(background.z()));
+
+		int count = defocus_angle > 0 ? 8 : 4;
+
+		#pragma omp parallel for schedule(static)
+		for (int j = 0; j < region_height; j++) {
+			for (int i = 0; i < region_width; i++) {
+				color albedo(0, 0, 0);
+				vec3 normal(0, 0, 0);
+				double depth = 0;
+				// Lens points on a spiral, turned from pixel to pixel so that blurred edges dither
+				// rather than repeat.
+				auto turn = std::fmod(0.7548776662 * (region_x + i) + 0.5698402910 * (region_y + j), 1.0);
+				for (int k = 0; k < count; k++) {
+					auto pixel_sample = pixel00_loc + (region_x + i + 0.5 * (k % 2) - 0.25) * pixel_delta_u
+									  + (region_y + j + 0.5 * (k / 2 % 2) - 0.25) * pixel_delta_v;
+					auto origin = center;
+					if (defocus_angle > 0) {
+						auto radius = std::sqrt((k + 0.5) / count), angle = 2 * pi * (0.6180339887 * k + turn);
+						origin += radius * std::cos(angle) * defocus_disk_u + radius * std::sin(angle) * defocus_disk_v;
+					}
+					ray r(origin, pixel_sample - origin, 0, cone_spread);
+					hit_record rec;
+					if (world.hit(r, interval(0.001, infinity), rec)) {
+						albedo += rec.mat->surface_albedo(r, rec);
+						normal += rec.normal;
+						depth += rec.t * r.direction().length();
+					}
+					else {
+						albedo += background_albedo;
+						depth += feature_buffers::far;
+					}
+				}
+				auto index = size_t(j) * region_width + i;
+				f.albedo[index] = albedo / count;
+				f.normal[index] = normal.length_squared() > 0 ? unit_vector(normal) : normal;
+				f.depth[index] = depth / count;
+			}
+		}
+		return f;
+	}
+
+	void write_header(std::ostream& out) const {
+		// A cropped image says where it belongs, in a comment that merge_tiles reads.
+		out << "P3\n";
+		if (region_width != image_width || region_height != image_height)
+			out << "# crop " << region_x << ' ' << region_y << " of " << image_width << ' ' << image_height << '\n';
+		out << region_width << ' ' << region_height << "\n255\n";
+	}
+
+	void write_rows(std::ostream& out, const std::vector<std::vector<color>>& img, int rows) const {
+		for (int j = 0; j < rows; j++)
+			for (int i = 0; i < region_width; i++)
+				write_color(out, pixel_samples_scale * img[i][j]);
+	}
+
+	std::vector<int> stratum_order(progressive_mode mode) const {
+		// The strata of a pixel (s_j * sqrt_spp + s_i) in the order they are rendered: grid
+		// order in a single pass, otherwise at a stride coprime to their count, about 0.618 of
+		// it, so that every pass, and every render cut short, spreads over the pixel.
+		int n = sqrt_spp * sqrt_spp;
+		std::vector<int> order(n);
+		std::iota(order.begin(), order.end(), 0);
+		if (mode == PROGRESSIVE_OFF) return order;
+
+		int stride = std::max(1, int(n * 0.618));
+		while (std::gcd(stride, n) != 1) stride++;
+		for (int k = 0; k < n; k++) order[k] = int(int64_t(k) * stride % n);
+		return order;
+	}
+
+	static size_t pass_size(progressive_mode mode, size_t samples_done, size_t samples_total) {
+		// Samples per pixel of the next pass.
+		size_t size = samples_total;
+		if (mode == PROGRESSIVE_SINGLE) size = 1;
+		else if (mode == PROGRESSIVE_DOUBLING) size = samples_done < 2 ? 1 : samples_done;
+		return std::min(size, samples_total - samples_done);
+	}
+
+	std::vector<ray> probe_rays() const {
+		// Pinhole rays through the centers of a grid of about 16K pixels. They use no random
+		// numbers, so probing does not change the rendered image.
+		int step = std::max(1, int(std::sqrt(double(image_width) * image_height / 16384)));
+		std::vector<ray> rays;
+		for (int j = 0; j < image_height; j += step) {
+			for (int i = 0; i < image_width; i += step) {
+				auto pixel_center = pixel00_loc + (i * pixel_delta_u) + (j * pixel_delta_v);
+				rays.push_back(ray(center, pixel_center - center));
+			}
+		}
+		return rays;
 	}
 
 	ray get_ray(int i, int j, int s_i, int s_j) {
@@ -127,7 +550,7 @@ private:
 		auto ray_origin = (defocus_angle<=0) ? center : defocus_disk_sample();
 		auto ray_direction = pixel_sample - ray_origin;
 
-		return ray(ray_origin, ray_direction);
+		return ray(ray_origin, ray_direction, 0, cone_spread);
 	}
 
 	vec3 sample_square() const {
@@ -153,8 +576,10 @@ private:
 
 	color ray_color(const ray& r, double depth, const hittable_list& world, const hittable_list& lights) {
 		if (depth <= 0) {
+			RT_STAT(STAT_MAX_DEPTH);
 			return color(0, 0, 0);
 		}
+		rays_traced++;
 
 		hit_record rec;
 		if (!world.hit(r, interval(0.001, infinity), rec)) {
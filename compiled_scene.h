@@ -0,0 +1,475 @@
+#ifndef COMPILED_SCENE_H
+#define COMPILED_SCENE_H
+
+#include "box.h"
+#include "bvh.h"
+#include "flat_bvh.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "quad.h"
+#include "sphere.h"
+
+#include <typeinfo>
+#include <unordered_map>
+#include <vector>
+
+// Closed-set form of a scene, used for rendering. The virtual hittable, material and texture
+// classes stay the authoring API; compiled_scene copies the types it knows into one array per
+// type and dispatches on a tag, so sphere, quad and box intersection inline into BVH traversal
+// and shading needs no virtual calls or pdf allocations. Anything else is kept behind its
+// virtual interface.
+
+class compiled_scene {
+public:
+	compiled_scene(const hittable& world, const hittable_list& lights) {
+		add_world(world);
+		for (const auto& light : lights.objects) add_light(*light);
+		build_bvh();
+	}
+
+	color ray_color(const ray& r, int depth, const color& background) const {
+		// Same estimator as camera::ray_color.
+		if (depth <= 0) {
+			RT_STAT(STAT_MAX_DEPTH);
+			return color(0, 0, 0);
+		}
+		rays_traced++;
+
+		hit_record rec;
+		material_ref mat;
+		if (!hit(r, interval(0.001, infinity), rec, mat)) {
+			return background;
+		}
+
+		bool cosine_lobe = true;	// Lambertian scatters with a cosine lobe, isotropic uniformly
+		color attenuation;
+		switch (mat.tag) {
+			case MAT_LAMBERTIAN:
+				RT_STAT(STAT_LAMBERTIAN_SCATTERS);
+				attenuation = texture_value(lambertians[mat.index], r, rec);
+				break;
+			case MAT_ISOTROPIC:
+				RT_STAT(STAT_ISOTROPIC_SCATTERS);
+				attenuation = texture_value(isotropics[mat.index], ray(), rec);
+				cosine_lobe = false;
+				break;
+			case MAT_METAL: {
+				RT_STAT(STAT_METAL_SCATTERS);
+				const auto& m = metals[mat.index];
+				vec3 reflected = reflect(r.direction(), rec.normal);
+				reflected = unit_vector(reflected) + (random_unit_vector() * m.fuzz);
+				auto scattered = ray(rec.p, reflected, r.cone_width(rec.t), r.cone_spread());
+				return m.albedo * ray_color(scattered, depth - 1, background);
+			}
+			case MAT_DIELECTRIC: {
+				scatter_record srec;
+				dielectrics[mat.index].dielectric::scatter(r, rec, srec);
+				return srec.attenuation * ray_color(srec.skip_pdf_ray, depth - 1, background);
+			}
+			case MAT_DIFFUSE_LIGHT:
+				if (!rec.front_face) return color(0, 0, 0);
+				return texture_value(diffuse_lights[mat.index], r, rec);
+			case MAT_OTHER:
+				return virtual_ray_color(r, depth, rec, background);
+			default:
+				return color(0, 0, 0);
+		}
+
+		onb uvw(rec.normal);
+		auto material_generate = [&]() {
+			return cosine_lobe ? uvw.transform(random_cosine_direction()) : random_unit_vector();
+		};
+		auto material_pdf = [&](const vec3& direction) {
+			return cosine_lobe ? std::fmax(0, dot(unit_vector(direction), uvw.w()) / pi) : 1 / (4 * pi);
+		};
+
+		ray scattered;
+		double pdf_value;
+		if (light_refs.empty()) {
+			scattered = ray(rec.p, material_generate());
+			pdf_value = material_pdf(scattered.direction());
+		}
+		else {
+			scattered = ray(rec.p, random_double() < 0.5 ? light_random(rec.p) : material_generate());
+			pdf_value = 0.5 * light_pdf_value(rec.p, scattered.direction())
+					  + 0.5 * material_pdf(scattered.direction());
+		}
+
+		double scatter_pdf = 1 / (4 * pi);
+		if (cosine_lobe) {
+			double cos_theta = dot(rec.normal, unit_vector(scattered.direction()));
+			scatter_pdf = cos_theta < 0 ? 0 : cos_theta / pi;
+		}
+
+		return attenuation * scatter_pdf * ray_color(scattered, depth - 1, background) / pdf_value;
+	}
+
+	void report(std::ostream& out) const {
+		out << "Compiled scene: " << spheres.size() << " spheres, " << quads.size() << " quads, "
+			<< boxes.size() << " boxes, " << others.size() << " virtual hittables, "
+			<< light_refs.size() << " lights; "
+			<< lambertians.size() + metals.size() + dielectrics.size() + diffuse_lights.size() + isotropics.size()
+			<< " materials (+" << other_material_count << " virtual), "
+			<< solid_colors.size() + checkers.size() << " textures (+" << other_textures.size() << " virtual)\n";
+	}
+
+private:
+	enum prim_tag : uint32_t { PRIM_SPHERE, PRIM_QUAD, PRIM_BOX, PRIM_OTHER };
+	enum material_tag : uint32_t {
+		MAT_NONE, MAT_LAMBERTIAN, MAT_METAL, MAT_DIELECTRIC, MAT_DIFFUSE_LIGHT, MAT_ISOTROPIC, MAT_OTHER
+	};
+	enum texture_tag : uint32_t { TEX_SOLID, TEX_CHECKER, TEX_OTHER };
+
+	struct material_ref { uint32_t tag = MAT_NONE, index = 0; };
+	struct texture_ref { uint32_t tag, index; };
+	struct prim_ref { uint32_t tag, index; material_ref mat; };
+
+	struct metal_data { color albedo; double fuzz; };
+	struct checker_data { double inv_scale; texture_ref even, odd; };
+
+	// Primitives. `prims` is in BVH leaf order and so are the per-type arrays.
+	std::vector<prim_ref> prims;
+	std::vector<sphere> spheres;
+	std::vector<quad> quads;
+	std::vector<box> boxes;
+	std::vector<const hittable*> others;
+	flat_bvh bvh;
+
+	// Lights, sampled like a hittable_list of the scene lights.
+	std::vector<prim_ref> light_refs;
+	std::vector<sphere> light_spheres;
+	std::vector<quad> light_quads;
+	std::vector<const hittable*> light_others;
+
+	// Materials and textures.
+	std::vector<texture_ref> lambertians, diffuse_lights, isotropics;
+	std::vector<metal_data> metals;
+	std::vector<dielectric> dielectrics;
+	size_t other_material_count = 0;
+	std::vector<color> solid_colors;
+	std::vector<checker_data> checkers;
+	std::vector<const texture*> other_textures;
+	std::unordered_map<const material*, material_ref> material_lookup;
+	std::unordered_map<const texture*, texture_ref> texture_lookup;
+
+	void add_world(const hittable& object) {
+		// Flattens lists and BVHs; the scene gets a single BVH of its own.
+		const auto& type = typeid(object);
+		if (type == typeid(hittable_list)) {
+			for (const auto& child : static_cast<const hittable_list&>(object).objects) add_world(*child);
+		}
+		else if (type == typeid(bvh_node)) {
+			const auto& node = static_cast<const bvh_node&>(object);
+			add_world(*node.left);
+			if (node.right != node.left) add_world(*node.right);
+		}
+		else if (type == typeid(bvh_tree)) {
+			for (const auto& child : static_cast<const bvh_tree&>(object).objects) add_world(*child);
+		}
+		else if (type == typeid(sphere)) {
+			const auto& s = static_cast<const sphere&>(object);
+			add_prim(PRIM_SPHERE, spheres.size(), add_material(s.mat.get()));
+			spheres.push_back(s);
+		}
+		else if (type == typeid(quad)) {
+			const auto& q = static_cast<const quad&>(object);
+			add_prim(PRIM_QUAD, quads.size(), add_material(q.mat.get()));
+			quads.push_back(q);
+		}
+		else if (type == typeid(box)) {
+			const auto& b = static_cast<const box&>(object);
+			add_prim(PRIM_BOX, boxes.size(), add_material(b.mat.get()));
+			boxes.push_back(b);
+		}
+		else {
+			add_prim(PRIM_OTHER, others.size(), material_ref{ MAT_OTHER, 0 });
+			others.push_back(&object);
+		}
+	}
+
+	void add_prim(uint32_t tag, size_t index, material_ref mat) {
+		prims.push_back(prim_ref{ tag, uint32_t(index), mat });
+	}
+
+	void add_light(const hittable& light) {
+		const auto& type = typeid(light);
+		if (type == typeid(sphere)) {
+			light_refs.push_back(prim_ref{ PRIM_SPHERE, uint32_t(light_spheres.size()), {} });
+			light_spheres.push_back(static_cast<const sphere&>(light));
+		}
+		else if (type == typeid(quad)) {
+			light_refs.push_back(prim_ref{ PRIM_QUAD, uint32_t(light_quads.size()), {} });
+			light_quads.push_back(static_cast<const quad&>(light));
+		}
+		else {
+			light_refs.push_back(prim_ref{ PRIM_OTHER, uint32_t(light_others.size()), {} });
+			light_others.push_back(&light);
+		}
+	}
+
+	material_ref add_material(const material* mat) {
+		if (!mat) return material_ref{};
+		auto found = material_lookup.find(mat);
+		if (found != material_lookup.end()) return found->second;
+
+		material_ref ref;
+		const auto& type = typeid(*mat);
+		if (type == typeid(lambertian)) {
+			ref = { MAT_LAMBERTIAN, uint32_t(lambertians.size()) };
+			lambertians.push_back(add_texture(static_cast<const lambertian*>(mat)->tex.get()));
+		}
+		else if (type == typeid(metal)) {
+			auto m = static_cast<const metal*>(mat);
+			ref = { MAT_METAL, uint32_t(metals.size()) };
+			metals.push_back(metal_data{ m->albedo, m->fuzz });
+		}
+		else if (type == typeid(dielectric)) {
+			ref = { MAT_DIELECTRIC, uint32_t(dielectrics.size()) };
+			dielectrics.push_back(*static_cast<const dielectric*>(mat));
+		}
+		else if (type == typeid(diffuse_light)) {
+			ref = { MAT_DIFFUSE_LIGHT, uint32_t(diffuse_lights.size()) };
+			diffuse_lights.push_back(add_texture(static_cast<const diffuse_light*>(mat)->tex.get()));
+		}
+		else if (type == typeid(isotropic)) {
+			ref = { MAT_ISOTROPIC, uint32_t(isotropics.size()) };
+			isotropics.push_back(add_texture(static_cast<const isotropic*>(mat)->tex.get()));
+		}
+		else {
+			// Shaded through the hit record's material pointer.
+			ref = { MAT_OTHER, 0 };
+			other_material_count++;
+		}
+		material_lookup.emplace(mat, ref);
+		return ref;
+	}
+
+	texture_ref add_texture(const texture* tex) {
+		auto found = texture_lookup.find(tex);
+		if (found != texture_lookup.end()) return found->second;
+
+		texture_ref ref;
+		const auto& type = typeid(*tex);
+		if (type == typeid(solid_color)) {
+			ref = { TEX_SOLID, uint32_t(solid_colors.size()) };
+			solid_colors.push_back(static_cast<const solid_color*>(tex)->albedo);
+		}
+		else if (type == typeid(checker_texture)) {
+			auto c = static_cast<const checker_texture*>(tex);
+			checker_data data{ c->inv_scale, add_texture(c->even.get()), add_texture(c->odd.get()) };
+			ref = { TEX_CHECKER, uint32_t(checkers.size()) };
+			checkers.push_back(data);
+		}
+		else {
+			ref = { TEX_OTHER, uint32_t(other_textures.size()) };
+			other_textures.push_back(tex);
+		}
+		texture_lookup.emplace(tex, ref);
+		return ref;
+	}
+
+	void build_bvh() {
+		std::vector<flat_bvh::build_prim> build_prims(prims.size());
+		for (size_t i = 0; i < prims.size(); i++) {
+			build_prims[i].bounds.grow(prim_bounding_box(prims[i]));
+			build_prims[i].index = uint32_t(i);
+		}
+		auto order = bvh.build(std::move(build_prims), max_leaf_size);
+
+		// Store the primitives of every type in the order the leaves visit them.
+		std::vector<prim_ref> sorted_prims;
+		std::vector<sphere> sorted_spheres;
+		std::vector<quad> sorted_quads;
+		std::vector<box> sorted_boxes;
+		std::vector<const hittable*> sorted_others;
+		sorted_prims.reserve(prims.size());
+		sorted_spheres.reserve(spheres.size());
+		sorted_quads.reserve(quads.size());
+		sorted_boxes.reserve(boxes.size());
+		sorted_others.reserve(others.size());
+		for (auto index : order) {
+			auto prim = prims[index];
+			switch (prim.tag) {
+				case PRIM_SPHERE:
+					sorted_spheres.push_back(spheres[prim.index]);
+					prim.index = uint32_t(sorted_spheres.size() - 1);
+					break;
+				case PRIM_QUAD:
+					sorted_quads.push_back(quads[prim.index]);
+					prim.index = uint32_t(sorted_quads.size() - 1);
+					break;
+				case PRIM_BOX:
+					sorted_boxes.push_back(boxes[prim.index]);
+					prim.index = uint32_t(sorted_boxes.size() - 1);
+					break;
+				default:
+					sorted_others.push_back(others[prim.index]);
+					prim.index = uint32_t(sorted_others.size() - 1);
+			}
+			sorted_prims.push_back(prim);
+		}
+		prims.swap(sorted_prims);
+		spheres.swap(sorted_spheres);
+		quads.swap(sorted_quads);
+		boxes.swap(sorted_boxes);
+		others.swap(sorted_others);
+	}
+
+	aabb prim_bounding_box(const prim_ref& prim) const {
+		switch (prim.tag) {
+			case PRIM_SPHERE: return spheres[prim.index].bbox;
+			case PRIM_QUAD: return quads[prim.index].bbox;
+			case PRIM_BOX: return boxes[prim.index].bbox;
+			default: return others[prim.index]->bounding_box();
+		}
+	}
+
+	bool hit(const ray& r, interval ray_t, hit_record& rec, material_ref& mat) const {
+		double closest = ray_t.max;
+		uint32_t hit_prim = UINT32_MAX;
+
+		bvh.traverse(r, ray_t.min, closest, [&](uint32_t first, uint32_t count) {
+			for (uint32_t i = first; i < first + count; i++) {
+				if (hit_prim_ref(prims[i], r, interval(ray_t.min, closest), rec)) {
+					closest = rec.t;
+					hit_prim = i;
+				}
+			}
+		});
+
+		if (hit_prim == UINT32_MAX) return false;
+		mat = prims[hit_prim].mat;
+		return true;
+	}
+
+	bool hit_prim_ref(const prim_ref& prim, const ray& r, interval ray_t, hit_record& rec) const {
+		// Qualified calls are not virtual, so the compiler can inline them here.
+		switch (prim.tag) {
+			case PRIM_SPHERE: return spheres[prim.index].sphere::hit(r, ray_t, rec);
+			case PRIM_QUAD: return hit_quad(quads[prim.index], r, ray_t, rec);
+			case PRIM_BOX: return boxes[prim.index].box::hit(r, ray_t, rec);
+			default: return others[prim.index]->hit(r, ray_t, rec);
+		}
+	}
+
+	static bool hit_quad(const quad& q, const ray& r, interval ray_t, hit_record& rec) {
+		// quad::hit with the parallelogram interior test inlined; only exact quads are compiled.
+		RT_STAT(STAT_QUAD_TESTS);
+		auto ndotd = dot(q.normal, r.direction());
+		if (std::fabs(ndotd) < 1e-8) return false;
+
+		auto t = (q.D - dot(q.normal, r.origin())) / ndotd;
+		if (!ray_t.contains(t)) return false;
+
+		auto I = r.at(t);
+		auto p = I - q.Q;
+		double a = dot(q.w, cross(p, q.v));
+		double b = dot(q.w, cross(q.u, p));
+		if (a < 0 || a > 1 || b < 0 || b > 1) return false;
+
+		rec.u = a;
+		rec.v = b;
+		rec.t = t;
+		rec.p = I;
+		rec.dpdu = q.u;
+		rec.dpdv = q.v;
+		rec.mat = q.mat.get();
+		rec.set_face_normal(r, q.normal);
+		return true;
+	}
+
+	color texture_value(texture_ref tex, const ray& r, const hit_record& rec) const {
+		// `r` gives the filter footprint of image lookups; pass a ray without a cone for none.
+		const auto& p = rec.p;
+		while (tex.tag == TEX_CHECKER) {
+			const auto& c = checkers[tex.index];
+			auto xint = int(std::floor(c.inv_scale * p.x()));
+			auto yint = int(std::floor(c.inv_scale * p.y()));
+			auto zint = int(std::floor(c.inv_scale * p.z()));
+			tex = (xint + yint + zint) % 2 == 0 ? c.even : c.odd;
+		}
+		if (tex.tag == TEX_SOLID) return solid_colors[tex.index];
+		double du, dv;
+		rec.texture_footprint(r, du, dv);
+		return other_textures[tex.index]->value(rec.u, rec.v, p, du, dv);
+	}
+
+	double light_pdf_value(const point3& origin, const vec3& direction) const {
+		// The average over the lights, as hittable_list::pdf_value.
+		auto sum = 0.0;
+		for (const auto& light : light_refs) {
+			switch (light.tag) {
+				case PRIM_SPHERE: sum += sphere_pdf_value(light_spheres[light.index], origin, direction); break;
+				case PRIM_QUAD: sum += quad_pdf_value(light_quads[light.index], origin, direction); break;
+				default: sum += light_others[light.index]->pdf_value(origin, direction);
+			}
+		}
+		return sum / light_refs.size();
+	}
+
+	vec3 light_random(const point3& origin) const {
+		const auto& light = light_refs[random_int(0, int(light_refs.size()) - 1)];
+		switch (light.tag) {
+			case PRIM_SPHERE: return light_spheres[light.index].sphere::random(origin);
+			case PRIM_QUAD: return light_quads[light.index].quad::random(origin);
+			default: return light_others[light.index]->random(origin);
+		}
+	}
+
+	static double sphere_pdf_value(const sphere& s, const point3& origin, const vec3& direction) {
+		RT_STAT(STAT_SHADOW_RAYS);
+		hit_record rec;
+		if (!s.sphere::hit(ray(origin, direction), interval(0.001, infinity), rec))
+			return 0;
+
+		double cos_theta = std::sqrt(1 - (s.radius * s.radius) / (origin - s.center).length_squared());
+		return 1 / (2 * pi * (1 - cos_theta));
+	}
+
+	static double quad_pdf_value(const quad& q, const point3& origin, const vec3& direction) {
+		RT_STAT(STAT_SHADOW_RAYS);
+		hit_record rec;
+		if (!hit_quad(q, ray(origin, direction), interval(0.001, infinity), rec))
+			return 0;
+
+		auto distance_squared = rec.t * rec.t * direction.length_squared();
+		auto cosine = std::fabs(dot(direction, rec.normal) / direction.length());
+		return distance_squared / (cosine * q.area);
+	}
+
+	color virtual_ray_color(const ray& r, int depth, const hit_record& rec, const color& background) const {
+		// Materials outside the closed set, shaded through their virtual interface.
+		scatter_record srec;
+		color emitted_light = rec.mat->emitted(r, rec, rec.u, rec.v, rec.p);
+
+		if (!rec.mat->scatter(r, rec, srec)) {
+			return emitted_light;
+		}
+
+		if (srec.skip_pdf) {
+			return srec.attenuation * ray_color(srec.skip_pdf_ray, depth - 1, background);
+		}
+
+		ray scattered;
+		double pdf_value;
+		if (light_refs.empty()) {
+			scattered = ray(rec.p, srec.pdf_ptr->generate());
+			pdf_value = srec.pdf_ptr->value(scattered.direction());
+		}
+		else {
+			scattered = ray(rec.p, random_double() < 0.5 ? light_random(rec.p) : srec.pdf_ptr->generate());
+			pdf_value = 0.5 * light_pdf_value(rec.p, scattered.direction())
+					  + 0.5 * srec.pdf_ptr->value(scattered.direction());
+		}
+
+		double scatter_pdf = rec.mat->scattering_pdf(r, rec, scattered);
+
+		color scattered_light
+			= srec.attenuation * scatter_pdf * ray_color(scattered, depth - 1, background) / pdf_value;
+		return scattered_light + emitted_light;
+	}
+
+	static const int max_leaf_size = 4;
+};
+
+#endif // !COMPILED_SCENE_H
@@ -0,0 +1,281 @@
+// Equal-time convergence benchmark: renders each scene under each configuration at a ladder
+// of sample counts and measures the error of every render against a high sample count
+// reference, so that changes to the estimator are judged by the error they reach in a given
+// time rather than by their ray throughput. References are rendered once and cached as PFM.
+
+#include "rtweekend.h"
+
+#include "scenes.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+struct configuration {
+	const char* name;
+	void (*apply)(scene_setup& s);
+};
+
+static const configuration configurations[] = {
+	{ "default", [](scene_setup&) {} },
+	{ "devirtualized", [](scene_setup& s) { s.cam.devirtualize = true; } },
+	// Without lights to sample, every bounce follows its material's own distribution.
+	{ "bsdf_only", [](scene_setup& s) { s.lights.clear(); } },
+	{ "denoised", [](scene_setup& s) { s.cam.denoise = true; } },
+};
+
+struct image_error {
+	double rel_mse = 0;			// Mean of (x - ref)^2 / (ref^2 + 0.01) over channels
+	double display_rmse = 0;	// RMSE of the gamma-corrected [0,1] values written to the PPM
+	size_t invalid = 0;			// Non-finite channels, counted as zero
+};
+
+struct rung {
+	int samples_per_pixel;
+	double seconds;				// Scene compile and render
+	image_error error;
+};
+
+struct convergence_run {
+	std::string scene, config;
+	std::vector<rung> rungs;
+};
+
+static std::vector<std::string> split(const std::string& list) {
+	std::vector<std::string> items;
+	std::stringstream in(list);
+	for (std::string item; std::getline(in, item, ',');)
+		if (!item.empty()) items.push_back(item);
+	return items;
+}
+
+static bool write_pfm(const std::string& path, int width, const std::vector<color>& pixels) {
+	// Little-endian RGB floats, bottom row first.
+	std::ofstream out(path, std::ios::binary);
+	int height = int(pixels.size() / width);
+	out << "PF\n" << width << ' ' << height << "\n-1.0\n";
+	std::vector<float> row(3 * size_t(width));
+	for (int j = height - 1; j >= 0; j--) {
+		for (int i = 0; i < width; i++)
+			for (int k = 0; k < 3; k++) row[3 * i + k] = float(pixels[size_t(j) * width + i][k]);
+		out.write(reinterpret_cast<const char*>(row.data()), row.size() * sizeof(float));
+	}
+	return bool(out);
+}
+
+static bool read_pfm(const std::string& path, int width, std::vector<color>& pixels) {
+	// Reads an image written by write_pfm; false if there is none of the given width.
+	std::ifstream in(path, std::ios::binary);
+	std::string magic;
+	int w = 0, h = 0;
+	double scale = 0;
+	if (!(in >> magic >> w >> h >> scale) || magic != "PF" || w != width || h <= 0 || scale >= 0) return false;
+	in.get();
+	pixels.assign(size_t(w) * h, color(0, 0, 0));
+	std::vector<float> row(3 * size_t(w));
+	for (int j = h - 1; j >= 0; j--) {
+		if (!in.read(reinterpret_cast<char*>(row.data()), row.size() * sizeof(float))) return false;
+		for (int i = 0; i < w; i++)
+			pixels[size_t(j) * w + i] = color(row[3 * i], row[3 * i + 1], row[3 * i + 2]);
+	}
+	return true;
+}
+
+static image_error measure_error(const std::vector<color>& image, const std::vector<color>& reference) {
+	static const interval intensity(0.0, 1.0);
+	image_error e;
+	for (size_t p = 0; p < image.size(); p++) {
+		for (int k = 0; k < 3; k++) {
+			auto x = image[p][k], ref = reference[p][k];
+			if (!std::isfinite(x)) {
+				e.invalid++;
+				x = 0;
+			}
+			auto d = x - ref;
+			e.rel_mse += d * d / (ref * ref + 0.01);
+			auto dd = intensity.clamp(linear_to_gamma(x)) - intensity.clamp(linear_to_gamma(ref));
+			e.display_rmse += dd * dd;
+		}
+	}
+	auto n = 3.0 * image.size();
+	e.rel_mse /= n;
+	e.display_rmse = std::sqrt(e.display_rmse / n);
+	return e;
+}
+
+static void render(const scene_entry& entry, const configuration* config, unsigned seed, int width, int spp,
+				   std::vector<color>& pixels, double& seconds) {
+	// The scene is built from `seed`, as every render of it must be, and rendered from a seed
+	// of its own so that renders at different sample counts, and the reference (which has no
+	// configuration), are independent.
+	std::srand(seed);
+	scene_setup s;
+	entry.build(s);
+	if (config) config->apply(s);
+	s.cam.image_width = width;
+	s.cam.samples_per_pixel = spp;
+	s.cam.output = nullptr;
+	std::srand(seed * 7919 + (config ? spp : 0));
+	s.cam.render(s.world, s.lights);
+	pixels = s.cam.pixels;
+	seconds = s.cam.stats.build_seconds + s.cam.stats.render_seconds + s.cam.stats.denoise_seconds;
+}
+
+static void write_json(std::ostream& out, int width, int reference_spp, const std::vector<double>& budgets,
+					   const std::vector<convergence_run>& runs) {
+	out << "{\n  \"image_width\": " << width << ",\n  \"reference_samples_per_pixel\": " << reference_spp
+		<< ",\n  \"runs\": [\n";
+	for (size_t r = 0; r < runs.size(); r++) {
+		const auto& run = runs[r];
+		out << "    { \"scene\": \"" << run.scene << "\", \"config\": \"" << run.config << "\",\n      \"rungs\": [\n";
+		for (size_t i = 0; i < run.rungs.size(); i++) {
+			const auto& g = run.rungs[i];
+			out << "        { \"samples_per_pixel\": " << g.samples_per_pixel << ", \"seconds\": " << g.seconds
+				<< ", \"rel_mse\": " << g.error.rel_mse << ", \"display_rmse\": " << g.error.display_rmse
+				<< ", \"invalid\": " << g.error.invalid << ", \"efficiency\": " << 1 / (g.error.rel_mse * g.seconds)
+				<< " }" << (i + 1 < run.rungs.size() ? "," : "") << '\n';
+		}
+		out << "      ],\n      \"at_budget\": [";
+		for (size_t b = 0; b < budgets.size(); b++) {
+			// The error of the most samples rendered within each budget.
+			const rung* best = nullptr;
+			for (const auto& g : run.rungs)
+				if (g.seconds <= budgets[b]) best = &g;
+			out << (b ? ", " : "") << "{ \"seconds\": " << budgets[b] << ", \"rel_mse\": ";
+			if (best) out << best->error.rel_mse;
+			else out << "null";
+			out << " }";
+		}
+		out << "] }" << (r + 1 < runs.size() ? "," : "") << '\n';
+	}
+	out << "  ]\n}\n";
+}
+
+int main(int argc, char** argv) {
+	// Usage: convergence_bench [--scenes a,b,...] [--configs a,b,...] [--budgets s,s,...]
+	//                          [--width pixels] [--reference-spp n] [--max-spp n] [--cache dir]
+	//                          [--seed n] [--target relmse] [--json out.json] [--verbose]
+	// Each configuration renders at 1, 4, 9, 16, 36, ... samples per pixel (squares, about
+	// doubling) until a render takes longer than the largest budget or reaches the reference's
+	// sample count. The default scenes are the catalog's unscaled ones; configurations are
+	// listed at the top of this file. --target reports the fewest samples per pixel of each
+	// configuration that reach the given relMSE.
+	std::vector<std::string> scene_names, config_names;
+	std::vector<double> budgets = { 0.5, 1, 2, 4, 8 };
+	int width = 200, reference_spp = 4096, max_spp = 4096;
+	double target = 0;
+	unsigned seed = 1;
+	std::string cache_dir = "convergence_refs", json_path;
+	bool verbose = false;
+
+	for (int i = 1; i < argc; i++) {
+		auto arg = std::string(argv[i]);
+		if (arg == "--verbose") { verbose = true; continue; }
+		if (i + 1 >= argc) {
+			std::cerr << "ERROR: Missing value for '" << arg << "'.\n";
+			return 2;
+		}
+		auto value = std::string(argv[++i]);
+		if (arg == "--scenes") scene_names = split(value);
+		else if (arg == "--configs") config_names = split(value);
+		else if (arg == "--budgets") {
+			budgets.clear();
+			for (const auto& b : split(value)) budgets.push_back(std::stod(b));
+		}
+		else if (arg == "--width") width = std::max(1, std::stoi(value));
+		else if (arg == "--reference-spp") reference_spp = std::max(1, std::stoi(value));
+		else if (arg == "--max-spp") max_spp = std::max(1, std::stoi(value));
+		else if (arg == "--cache") cache_dir = value;
+		else if (arg == "--seed") seed = unsigned(std::stoul(value));
+		else if (arg == "--target") target = std::stod(value);
+		else if (arg == "--json") json_path = value;
+		else {
+			std::cerr << "ERROR: Unknown option '" << arg << "'.\n";
+			return 2;
+		}
+	}
+
+	if (scene_names.empty())
+		for (const auto& entry : scene_catalog())
+			if (!std::strstr(entry.name, "_x")) scene_names.push_back(entry.name);
+	std::vector<const configuration*> configs;
+	for (const auto& c : configurations)
+		if (config_names.empty() || std::find(config_names.begin(), config_names.end(), c.name) != config_names.end())
+			configs.push_back(&c);
+	if (configs.empty()) {
+		std::cerr << "ERROR: No such configurations.\n";
+		return 2;
+	}
+	auto max_budget = budgets.empty() ? 0.0 : *std::max_element(budgets.begin(), budgets.end());
+
+	auto log_buffer = std::clog.rdbuf();
+	if (!verbose) std::clog.rdbuf(nullptr);
+	std::filesystem::create_directories(cache_dir);
+
+	std::vector<convergence_run> runs;
+	for (const auto& name : scene_names) {
+		auto entry = find_scene(name);
+		if (!entry) {
+			std::cerr << "ERROR: Unknown scene '" << name << "'.\n";
+			continue;
+		}
+
+		std::vector<color> reference;
+		auto reference_path = cache_dir + "/" + name + "_" + std::to_string(width) + "w_"
+							+ std::to_string(seed) + "s_" + std::to_string(reference_spp) + "spp.pfm";
+		if (!read_pfm(reference_path, width, reference)) {
+			std::cout << name << ": rendering reference at " << reference_spp << " spp..." << std::flush;
+			double seconds;
+			render(*entry, nullptr, seed, width, reference_spp, reference, seconds);
+			if (!write_pfm(reference_path, width, reference))
+				std::cerr << "ERROR: Could not write reference '" << reference_path << "'.\n";
+			std::cout << ' ' << seconds << " s\n";
+		}
+
+		for (auto config : configs) {
+			convergence_run run{ name, config->name, {} };
+			for (int n = 1; n * n <= max_spp && n * n < reference_spp; n = std::max(n + 1, int(n * 1.415 + 0.5))) {
+				std::vector<color> image;
+				double seconds;
+				render(*entry, config, seed, width, n * n, image, seconds);
+				if (image.size() != reference.size()) break;
+				run.rungs.push_back({ n * n, seconds, measure_error(image, reference) });
+				if (seconds > max_budget) break;
+			}
+
+			std::cout << name << " / " << config->name << ":\n";
+			for (const auto& g : run.rungs) {
+				char line[160];
+				std::snprintf(line, sizeof line, "  %6d spp %9.3f s  relMSE %.4e  display RMSE %.4f%s\n",
+							  g.samples_per_pixel, g.seconds, g.error.rel_mse, g.error.display_rmse,
+							  g.error.invalid ? "  (non-finite samples)" : "");
+				std::cout << line;
+			}
+			if (target > 0) {
+				auto reached = std::find_if(run.rungs.begin(), run.rungs.end(),
+											[&](const rung& g) { return g.error.rel_mse <= target; });
+				if (reached != run.rungs.end())
+					std::cout << "  relMSE " << target << " reached at " << reached->samples_per_pixel << " spp in "
+							  << reached->seconds << " s\n";
+				else
+					std::cout << "  relMSE " << target << " not reached\n";
+			}
+			runs.push_back(run);
+		}
+	}
+
+	std::clog.rdbuf(log_buffer);
+	if (!json_path.empty()) {
+		std::ofstream out(json_path);
+		write_json(out, width, reference_spp, budgets, runs);
+		if (!out) {
+			std::cerr << "ERROR: Could not write '" << json_path << "'.\n";
+			return 2;
+		}
+	}
+}
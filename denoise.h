@@ -0,0 +1,227 @@
+#ifndef DENOISE_H
+#define DENOISE_H
+
+#include "color.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+struct feature_buffers {
+	// What the first hit of each pixel's camera rays sees, averaged over the pixel, row by row.
+	std::vector<color> albedo;
+	std::vector<vec3> normal;		// Unit length; zero where rays miss
+	std::vector<double> depth;		// Distance along the ray; `far` where rays miss
+
+	static constexpr double far = 1e20;
+};
+
+class atrous_denoiser {
+public:
+	// Edge-avoiding a-trous wavelet filter (Dammertz et al. 2010), with the luminance edge
+	// stopping function of SVGF (Schied et al. 2017): every iteration applies a 5x5 B3-spline
+	// kernel with holes of 2^i pixels, each tap weighted down by how much its features differ
+	// from the center's. Lighting is filtered demodulated by the albedo, so that texture
+	// detail is kept, and luminance differences are measured against the pixel's own estimated
+	// noise, which the filter propagates from iteration to iteration.
+	int iterations = 5;
+	float sigma_luminance = 4;		// Luminance difference, in standard deviations, of weight 1/e
+	float sigma_depth = 0.02f;		// Relative depth difference per pixel of weight 1/e
+	float sigma_albedo = 0.1f;		// Albedo difference of weight 1/e
+
+	std::vector<color> denoise(int width, int height, const std::vector<color>& image,
+							   const std::vector<double>& variance, const feature_buffers& features) const {
+		// `variance` is that of each pixel's mean luminance. Rows are filtered in parallel, and
+		// the taps of a row are evaluated as vectors over its pixels.
+		size_t n = size_t(width) * height;
+		planes p(n);
+		for (size_t k = 0; k < n; k++) {
+			for (int c = 0; c < 3; c++) {
+				p.albedo[c][k] = float(std::max(features.albedo[k][c], 0.01));
+				p.normal[c][k] = float(features.normal[k][c]);
+				// A non-finite pixel would spread to all its neighbors.
+				p.color[c][k] = std::isfinite(image[k][c]) ? float(image[k][c]) / p.albedo[c][k] : 0.0f;
+			}
+			p.normal[3][k] = features.normal[k].length_squared() > 0 ? 0.0f : 1.0f;
+			p.depth[k] = float(std::min(features.depth[k], feature_buffers::far));
+			auto a = luminance(color(p.albedo[0][k], p.albedo[1][k], p.albedo[2][k]));
+			p.variance[k] = float(std::isfinite(variance[k]) ? variance[k] / (a * a) : 0);
+		}
+
+		planes next(n);
+		std::vector<float> sigma(n);
+		for (int i = 0; i < iterations; i++) {
+			int step = 1 << i;
+			prefilter_sigma(width, height, p, sigma);
+			#pragma omp parallel for schedule(static)
+			for (int y = 0; y < height; y++)
+				filter_row(width, height, y, step, p, sigma, next);
+			std::swap(p.color, next.color);
+			std::swap(p.variance, next.variance);
+		}
+
+		std::vector<color> result(n);
+		for (size_t k = 0; k < n; k++)
+			result[k] = color(p.color[0][k] * p.albedo[0][k], p.color[1][k] * p.albedo[1][k], p.color[2][k] * p.albedo[2][k]);
+		return result;
+	}
+
+	static std::vector<double> spatial_variance(int width, int height, const std::vector<color>& image) {
+		// For images of a single sample per pixel, which have no per-pixel variance: that of the
+		// luminance over each pixel's 5x5 neighborhood, as SVGF estimates it for pixels with too
+		// little history. Edges raise it; the feature weights keep the filter from crossing them.
+		std::vector<double> variance(image.size());
+		#pragma omp parallel for schedule(static)
+		for (int y = 0; y < height; y++) {
+			for (int x = 0; x < width; x++) {
+				double sum = 0, squares = 0, count = 0;
+				for (int qy = std::max(0, y - 2); qy <= std::min(height - 1, y + 2); qy++) {
+					for (int qx = std::max(0, x - 2); qx <= std::min(width - 1, x + 2); qx++) {
+						auto l = luminance(image[size_t(qy) * width + qx]);
+						if (!std::isfinite(l)) continue;
+						sum += l;
+						squares += l * l;
+						count++;
+					}
+				}
+				auto mean = count > 0 ? sum / count : 0;
+				variance[size_t(y) * width + x] = count > 1 ? std::max(0.0, squares / count - mean * mean) : 0;
+			}
+		}
+		return variance;
+	}
+
+private:
+	struct planes {
+		// One channel per array, so that the filter's loops run over contiguous floats. Normals
+		// have a fourth component, 1 for pixels that miss the scene and 0 for the others, so that
+		// misses match each other and no hit without a test in the loop.
+		std::vector<float> color[3], variance, albedo[3], normal[4], depth;
+
+		explicit planes(size_t n) : variance(n), depth(n) {
+			for (int c = 0; c < 3; c++) {
+				color[c].resize(n);
+				albedo[c].resize(n);
+			}
+			for (auto& c : normal) c.resize(n);
+		}
+	};
+
+	static const int normal_squarings = 7;	// The normals' dot product is raised to the power 2^7
+
+	static float positive(float x) {
+		// max(x, 0) as arithmetic; a comparison would keep the filter's loop from vectorizing.
+		return 0.5f * (x + std::fabs(x));
+	}
+
+	static float exp_neg(float x) {
+		// About e^-x for x >= 0, as (1 - x/256)^256.
+		auto y = positive(1.0f - x * (1.0f / 256));
+		for (int k = 0; k < 8; k++) y *= y;
+		return y;
+	}
+
+	void prefilter_sigma(int width, int height, const planes& p, std::vector<float>& sigma) const {
+		// The luminance scale of each pixel: its standard deviation, blurred over 3x3 pixels
+		// because a single pixel's estimate is itself noisy.
+		#pragma omp parallel for schedule(static)
+		for (int y = 0; y < height; y++) {
+			for (int x = 0; x < width; x++) {
+				float sum = 0, weights = 0;
+				for (int dy = -1; dy <= 1; dy++) {
+					for (int dx = -1; dx <= 1; dx++) {
+						int qx = x + dx, qy = y + dy;
+						if (qx < 0 || qy < 0 || qx >= width || qy >= height) continue;
+						float w = (dx ? 1 : 2) * (dy ? 1 : 2);
+						sum += w * p.variance[size_t(qy) * width + qx];
+						weights += w;
+					}
+				}
+				sigma[size_t(y) * width + x] = sigma_luminance * std::sqrt(sum / weights) + 1e-6f;
+			}
+		}
+	}
+
+	void filter_row(int width, int height, int y, int step, const planes& p,
+					const std::vector<float>& sigma, planes& out) const {
+		static const float kernel[5] = { 1.0f / 16, 1.0f / 4, 3.0f / 8, 1.0f / 4, 1.0f / 16 };
+		std::vector<float> sums(5 * size_t(width), 0.0f);
+		float* sum_w = &sums[0];
+		float* sum_r = &sums[width];
+		float* sum_g = &sums[2 * size_t(width)];
+		float* sum_b = &sums[3 * size_t(width)];
+		float* sum_v = &sums[4 * size_t(width)];
+		auto row = size_t(y) * width;
+		const float* r = &p.color[0][row];
+		const float* g = &p.color[1][row];
+		const float* b = &p.color[2][row];
+		const float* nx = &p.normal[0][row];
+		const float* ny = &p.normal[1][row];
+		const float* nz = &p.normal[2][row];
+		const float* nw = &p.normal[3][row];
+		const float* ar = &p.albedo[0][row];
+		const float* ag = &p.albedo[1][row];
+		const float* ab = &p.albedo[2][row];
+		const float* z = &p.depth[row];
+		const float* s = &sigma[row];
+		auto depth_scale = 1 / (sigma_depth * step);
+		auto albedo_scale = 1 / (sigma_albedo * sigma_albedo);
+
+		for (int ky = 0; ky < 5; ky++) {
+			int qy = y + (ky - 2) * step;
+			if (qy < 0 || qy >= height) continue;
+			for (int kx = 0; kx < 5; kx++) {
+				int offset = (kx - 2) * step;
+				int x0 = std::max(0, -offset), x1 = std::min(width, width - offset);
+				auto q = size_t(qy) * width;
+				const float* qr = p.color[0].data() + q;
+				const float* qg = p.color[1].data() + q;
+				const float* qb = p.color[2].data() + q;
+				const float* qv = p.variance.data() + q;
+				const float* qnx = p.normal[0].data() + q;
+				const float* qny = p.normal[1].data() + q;
+				const float* qnz = p.normal[2].data() + q;
+				const float* qnw = p.normal[3].data() + q;
+				const float* qar = p.albedo[0].data() + q;
+				const float* qag = p.albedo[1].data() + q;
+				const float* qab = p.albedo[2].data() + q;
+				const float* qz = p.depth.data() + q;
+				float h = kernel[kx] * kernel[ky];
+
+				#pragma omp simd
+				for (int x = x0; x < x1; x++) {
+					int qx = x + offset;
+					float lp = 0.2126f * r[x] + 0.7152f * g[x] + 0.0722f * b[x];
+					float lq = 0.2126f * qr[qx] + 0.7152f * qg[qx] + 0.0722f * qb[qx];
+					float d_l = std::fabs(lp - lq) / s[x];
+					float d_z = std::fabs(z[x] - qz[qx]) / (z[x] + 1e-6f) * depth_scale;
+					float da_r = ar[x] - qar[qx], da_g = ag[x] - qag[qx], da_b = ab[x] - qab[qx];
+					float d_a = (da_r * da_r + da_g * da_g + da_b * da_b) * albedo_scale;
+					float w_n = positive(nx[x] * qnx[qx] + ny[x] * qny[qx] + nz[x] * qnz[qx] + nw[x] * qnw[qx]);
+					for (int k = 0; k < normal_squarings; k++) w_n *= w_n;
+					float w = h * w_n * exp_neg(d_l + d_z + d_a);
+					sum_w[x] += w;
+					sum_r[x] += w * qr[qx];
+					sum_g[x] += w * qg[qx];
+					sum_b[x] += w * qb[qx];
+					sum_v[x] += w * w * qv[qx];
+				}
+			}
+		}
+
+		for (int x = 0; x < width; x++) {
+			// The center tap weighs in against itself, so sum_w is zero only if it underflowed.
+			if (!(sum_w[x] > 0)) {
+				for (int c = 0; c < 3; c++) out.color[c][row + x] = p.color[c][row + x];
+				out.variance[row + x] = p.variance[row + x];
+				continue;
+			}
+			out.color[0][row + x] = sum_r[x] / sum_w[x];
+			out.color[1][row + x] = sum_g[x] / sum_w[x];
+			out.color[2][row + x] = sum_b[x] / sum_w[x];
+			out.variance[row + x] = sum_v[x] / (sum_w[x] * sum_w[x]);
+		}
+	}
+};
+
+#endif // !DENOISE_H
@@ -0,0 +1,274 @@
+#ifndef FLAT_BVH_H
+#define FLAT_BVH_H
+
+#include "aabb.h"
+#include "stats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// Compact BVH over primitive indices, shared by primitives that store their geometry in flat
+// arrays (triangle_mesh, sphere_set) instead of one hittable object per primitive.
+
+class flat_bvh {
+public:
+	class build_bounds {
+	public:
+		float min[3] = { +INFINITY, +INFINITY, +INFINITY };
+		float max[3] = { -INFINITY, -INFINITY, -INFINITY };
+
+		void grow(const float* p) {
+			for (int a = 0; a < 3; a++) {
+				min[a] = p[a] < min[a] ? p[a] : min[a];
+				max[a] = p[a] > max[a] ? p[a] : max[a];
+			}
+		}
+
+		void grow(const build_bounds& b) {
+			for (int a = 0; a < 3; a++) {
+				min[a] = b.min[a] < min[a] ? b.min[a] : min[a];
+				max[a] = b.max[a] > max[a] ? b.max[a] : max[a];
+			}
+		}
+
+		void grow(const aabb& box) {
+			// Rounds outwards, so the float bounds still enclose the double precision box.
+			for (int a = 0; a < 3; a++) {
+				const auto& extent = box.axis_interval(a);
+				float lo = float(extent.min), hi = float(extent.max);
+				lo = lo > extent.min ? std::nextafter(lo, -INFINITY) : lo;
+				hi = hi < extent.max ? std::nextafter(hi, +INFINITY) : hi;
+				min[a] = lo < min[a] ? lo : min[a];
+				max[a] = hi > max[a] ? hi : max[a];
+			}
+		}
+
+		float half_area() const {
+			if (min[0] > max[0]) return 0;
+			float dx = max[0] - min[0], dy = max[1] - min[1], dz = max[2] - min[2];
+			return dx * dy + dy * dz + dz * dx;
+		}
+	};
+
+	struct build_prim {
+		build_bounds bounds;
+		float centroid[3];
+		uint32_t index;
+	};
+
+	struct node {
+		float min[3];
+		uint32_t offset;	// First primitive for leaves, left child for interior nodes
+		float max[3];
+		uint32_t count;		// Primitive count for leaves, 0 for interior nodes
+	};
+
+	static const int max_depth = 64;
+
+	std::vector<node> nodes;
+
+	std::vector<uint32_t> build(std::vector<build_prim> prims, int leaf_size, int group_size = 1) {
+		// Builds a binned-SAH tree and returns the primitive indices in leaf order. Callers
+		// permute their primitive arrays by this order so that every leaf covers a
+		// contiguous run [offset, offset + count). `group_size` is the number of primitives a
+		// leaf tests for the price of one, which steers the SAH towards full leaves.
+		max_leaf_size = leaf_size;
+		prim_group_size = group_size;
+		nodes.clear();
+		std::vector<uint32_t> order;
+		if (prims.empty()) return order;
+
+		for (auto& prim : prims) {
+			for (int a = 0; a < 3; a++)
+				prim.centroid[a] = 0.5f * (prim.bounds.min[a] + prim.bounds.max[a]);
+		}
+
+		nodes.reserve(2 * prims.size() / max_leaf_size + 1);
+		nodes.emplace_back();
+		build_node(0, 0, uint32_t(prims.size()), prims, 0);
+		nodes.shrink_to_fit();
+
+		order.resize(prims.size());
+		for (size_t i = 0; i < prims.size(); i++) order[i] = prims[i].index;
+		return order;
+	}
+
+	aabb bounding_box() const {
+		if (nodes.empty()) return aabb::empty;
+		const auto& root = nodes[0];
+		return aabb(point3(root.min[0], root.min[1], root.min[2]), point3(root.max[0], root.max[1], root.max[2]));
+	}
+
+	size_t memory_usage() const { return nodes.capacity() * sizeof(node); }
+
+	template <typename F>
+	void traverse(const ray& r, double t_min, const double& closest, F&& visit_leaf) const {
+		// Visits the leaves the ray may hit, nearest child first. visit_leaf(offset, count)
+		// tests the primitives and shrinks `closest`, which prunes the remaining nodes.
+		if (nodes.empty()) return;
+
+		const vec3& dir = r.direction();
+		float org[3] = { float(r.origin().x()), float(r.origin().y()), float(r.origin().z()) };
+		float inv_dir[3] = { float(1 / dir.x()), float(1 / dir.y()), float(1 / dir.z()) };
+
+		uint32_t stack[max_depth + 1];
+		int stack_size = 0;
+		uint32_t node_index = 0;
+		RT_STAT(STAT_AABB_TESTS);
+		if (node_entry(nodes[0], org, inv_dir, t_min, closest) == infinity) return;
+
+		while (true) {
+			const node& n = nodes[node_index];
+			RT_STAT(STAT_BVH_NODES);
+			if (n.count > 0) {
+				visit_leaf(n.offset, n.count);
+			}
+			else {
+				auto near_index = n.offset, far_index = n.offset + 1;
+				RT_STAT_ADD(STAT_AABB_TESTS, 2);
+				auto t_near = node_entry(nodes[near_index], org, inv_dir, t_min, closest);
+				auto t_far = node_entry(nodes[far_index], org, inv_dir, t_min, closest);
+				if (t_far < t_near) {
+					std::swap(near_index, far_index);
+					std::swap(t_near, t_far);
+				}
+				if (t_near != infinity) {
+					if (t_far != infinity) stack[stack_size++] = far_index;
+					node_index = near_index;
+					continue;
+				}
+			}
+			if (stack_size == 0) break;
+			node_index = stack[--stack_size];
+		}
+	}
+
+private:
+	static const int bin_count = 12;
+	int max_leaf_size = 4;
+	int prim_group_size = 1;
+
+	float leaf_cost(uint32_t count) const {
+		return float((count + prim_group_size - 1) / prim_group_size);
+	}
+
+	static double node_entry(const node& n, const float* org, const float* inv_dir, double t_min, double t_max) {
+		// Returns the ray parameter where the ray enters the node, or infinity on a miss.
+		float tmin = float(t_min), tmax = float(t_max);
+		for (int axis = 0; axis < 3; axis++) {
+			float t0 = (n.min[axis] - org[axis]) * inv_dir[axis];
+			float t1 = (n.max[axis] - org[axis]) * inv_dir[axis];
+			if (t0 > t1) std::swap(t0, t1);
+			// Widen the far plane slightly to stay conservative under float rounding.
+			t1 *= 1.0000004f;
+			tmin = t0 > tmin ? t0 : tmin;
+			tmax = t1 < tmax ? t1 : tmax;
+			if (tmax < tmin) return infinity;
+		}
+		return tmin;
+	}
+
+	void build_node(uint32_t node_index, uint32_t start, uint32_t end, std::vector<build_prim>& prims, int depth) {
+		build_bounds bounds, centroid_bounds;
+		for (auto i = start; i < end; i++) {
+			bounds.grow(prims[i].bounds);
+			centroid_bounds.grow(prims[i].centroid);
+		}
+		for (int a = 0; a < 3; a++) {
+			nodes[node_index].min[a] = bounds.min[a];
+			nodes[node_index].max[a] = bounds.max[a];
+		}
+
+		auto count = end - start;
+		auto make_leaf = [&]() {
+			nodes[node_index].offset = start;
+			nodes[node_index].count = count;
+		};
+		if (count <= uint32_t(max_leaf_size)) return make_leaf();
+
+		// Binned SAH, binning all three axes in a single pass over the primitives.
+		build_bounds bin_bounds[3][bin_count];
+		uint32_t bin_counts[3][bin_count] = {};
+		float scale[3];
+		for (int axis = 0; axis < 3; axis++) {
+			float extent = centroid_bounds.max[axis] - centroid_bounds.min[axis];
+			scale[axis] = extent > 0 ? bin_count / extent : 0;
+		}
+		for (auto i = start; i < end; i++) {
+			for (int axis = 0; axis < 3; axis++) {
+				auto bin = bin_of(prims[i].centroid[axis], centroid_bounds.min[axis], scale[axis]);
+				bin_counts[axis][bin]++;
+				bin_bounds[axis][bin].grow(prims[i].bounds);
+			}
+		}
+
+		int best_axis = -1, best_split = 0;
+		float best_cost = INFINITY;
+		for (int axis = 0; axis < 3; axis++) {
+			if (scale[axis] == 0) continue;
+
+			float right_cost[bin_count];
+			build_bounds right;
+			uint32_t right_count = 0;
+			for (int b = bin_count - 1; b > 0; b--) {
+				right.grow(bin_bounds[axis][b]);
+				right_count += bin_counts[axis][b];
+				right_cost[b] = leaf_cost(right_count) * right.half_area();
+			}
+
+			build_bounds left;
+			uint32_t left_count = 0;
+			for (int b = 0; b < bin_count - 1; b++) {
+				left.grow(bin_bounds[axis][b]);
+				left_count += bin_counts[axis][b];
+				float cost = leaf_cost(left_count) * left.half_area() + right_cost[b + 1];
+				if (left_count > 0 && left_count < count && cost < best_cost) {
+					best_cost = cost;
+					best_axis = axis;
+					best_split = b + 1;
+				}
+			}
+		}
+
+		uint32_t mid;
+		if (best_axis >= 0 && depth < max_depth - 8) {
+			// A split also pays for one more node visit, costed like a primitive group test.
+			float split_cost = bounds.half_area() + best_cost;
+			if (count <= 2 * uint32_t(max_leaf_size) && split_cost >= leaf_cost(count) * bounds.half_area())
+				return make_leaf();
+
+			auto split = std::partition(prims.begin() + start, prims.begin() + end, [&](const build_prim& prim) {
+				return bin_of(prim.centroid[best_axis], centroid_bounds.min[best_axis], scale[best_axis]) < best_split;
+			});
+			mid = uint32_t(split - prims.begin());
+		}
+		else {
+			// Coincident centroids or a very deep tree: fall back to a median split.
+			if (depth >= max_depth - 1) return make_leaf();
+			int axis = 0;
+			for (int a = 1; a < 3; a++)
+				if (bounds.max[a] - bounds.min[a] > bounds.max[axis] - bounds.min[axis]) axis = a;
+			mid = start + count / 2;
+			std::nth_element(prims.begin() + start, prims.begin() + mid, prims.begin() + end,
+				[&](const build_prim& a, const build_prim& b) { return a.centroid[axis] < b.centroid[axis]; });
+		}
+
+		auto left_index = uint32_t(nodes.size());
+		nodes.emplace_back();
+		nodes.emplace_back();
+		nodes[node_index].offset = left_index;
+		nodes[node_index].count = 0;
+
+		build_node(left_index, start, mid, prims, depth + 1);
+		build_node(left_index + 1, mid, end, prims, depth + 1);
+	}
+
+	static int bin_of(float centroid, float min, float scale) {
+		int bin = int((centroid - min) * scale);
+		return bin < 0 ? 0 : (bin >= bin_count ? bin_count - 1 : bin);
+	}
+};
+
+#endif // !FLAT_BVH_H
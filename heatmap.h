@@ -0,0 +1,102 @@
+#ifndef HEATMAP_H
+#define HEATMAP_H
+
+#include "color.h"
+#include "stats.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+class cost_heatmaps {
+public:
+	// Per-pixel cost of a render: wall-clock time and, when the counters are compiled in
+	// (RT_ENABLE_STATS), BVH nodes visited and primitives tested. Written as false-color
+	// images scaled to the 99th percentile, so that a few extreme pixels do not flatten the rest.
+	cost_heatmaps(int width, int height)
+		: width(width), height(height), seconds(size_t(width) * height), nodes(seconds.size()), prims(seconds.size()) {}
+
+	struct work {
+		uint64_t nodes = 0, prims = 0;
+	};
+
+	static work thread_work() {
+		// The calling thread's totals so far; a pixel's work is the difference across it.
+		work w;
+#ifdef RT_ENABLE_STATS
+		const auto& s = stat_registry::local();
+		w.nodes = s.counts[STAT_BVH_NODES];
+		for (auto c : { STAT_SPHERE_TESTS, STAT_QUAD_TESTS, STAT_BOX_TESTS, STAT_TRIANGLE_TESTS, STAT_SPHERE_SET_TESTS })
+			w.prims += s.counts[c];
+#endif
+		return w;
+	}
+
+	void record(int i, int j, double pixel_seconds, const work& before, const work& after) {
+		// Adds to the pixel's cost, which progressive renders record once per pass.
+		auto index = size_t(j) * width + i;
+		seconds[index] += pixel_seconds;
+		nodes[index] += double(after.nodes - before.nodes);
+		prims[index] += double(after.prims - before.prims);
+	}
+
+	void write(const std::string& prefix, std::ostream& log) const {
+		// Writes <prefix>_time.ppm, and <prefix>_nodes.ppm and <prefix>_prims.ppm if counted.
+		write_one(prefix + "_time.ppm", "time (us)", seconds, 1e6, log);
+#ifdef RT_ENABLE_STATS
+		write_one(prefix + "_nodes.ppm", "BVH nodes", nodes, 1, log);
+		write_one(prefix + "_prims.ppm", "primitive tests", prims, 1, log);
+#else
+		log << "Heatmaps: build with RT_ENABLE_STATS for BVH node and primitive test heatmaps\n";
+#endif
+	}
+
+private:
+	int width, height;
+	std::vector<double> seconds, nodes, prims;	// Per pixel, row by row
+
+	void write_one(const std::string& path, const char* what, const std::vector<double>& values, double unit,
+				   std::ostream& log) const {
+		auto sorted = values;
+		auto p99 = sorted.begin() + (sorted.size() - 1) * 99 / 100;
+		std::nth_element(sorted.begin(), p99, sorted.end());
+		auto scale = *p99 > 0 ? *p99 : 1.0;
+		auto sum = 0.0, max = 0.0;
+		for (auto v : values) {
+			sum += v;
+			max = std::max(max, v);
+		}
+
+		std::ofstream out(path);
+		out << "P3\n" << width << ' ' << height << "\n255\n";
+		for (auto v : values) {
+			auto c = colormap(v / scale);
+			out << int(255.999 * c.x()) << ' ' << int(255.999 * c.y()) << ' ' << int(255.999 * c.z()) << '\n';
+		}
+		if (!out) {
+			std::cerr << "ERROR: Could not write heatmap '" << path << "'.\n";
+			return;
+		}
+		log << "Heatmap " << path << ": " << what << " per pixel, mean " << sum / values.size() * unit
+			<< ", 99th percentile " << scale * unit << " (white), max " << max * unit << '\n';
+	}
+
+	static color colormap(double x) {
+		// Black through purple, red and orange to pale yellow, like matplotlib's inferno.
+		static const color stops[] = {
+			color(0.000, 0.000, 0.016), color(0.341, 0.063, 0.431), color(0.737, 0.216, 0.329),
+			color(0.976, 0.557, 0.035), color(0.988, 1.000, 0.643)
+		};
+		const int last = int(std::size(stops)) - 1;
+		auto s = std::clamp(x, 0.0, 1.0) * last;
+		auto k = std::min(int(s), last - 1);
+		auto f = s - k;
+		return (1 - f) * stops[k] + f * stops[k + 1];
+	}
+};
+
+#endif // !HEATMAP_H
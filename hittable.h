@@ -9,10 +9,12 @@ class hit_record {
 public:
 	point3 p;
 	vec3 normal;
-	shared_ptr<material> mat;
+	const material* mat;	// Not owning; the hit object keeps its material alive
 	double t;
 	double u;
 	double v;
+	vec3 dpdu;	// Change of p along u and along v; zero if the surface does not provide them
+	vec3 dpdv;
 	bool front_face;
 
 	void set_face_normal(const ray& r, const vec3& outward_normal) {
@@ -21,6 +23,17 @@ public:
 		front_face = dot(r.direction(), outward_normal) < 0;
 		normal = front_face ? outward_normal : -outward_normal;
 	}
+
+	void texture_footprint(const ray& r, double& du, double& dv) const {
+		// Extent in u and in v of the ray's cone where it hit, for filtering texture lookups.
+		// Both are zero, asking for the sharpest lookup, if either is unknown.
+		du = dv = 0;
+		auto width = r.cone_width(t);
+		auto lu = dpdu.length_squared(), lv = dpdv.length_squared();
+		if (width <= 0 || lu == 0 || lv == 0) return;
+		du = width / std::sqrt(lu);
+		dv = width / std::sqrt(lv);
+	}
 };
 
 class hittable {
@@ -43,6 +56,7 @@ public:
 	}
 	bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
 		// offset the ray
+		RT_STAT(STAT_INSTANCE_TESTS);
 		ray ray_offset(r.origin() - offset, r.direction());
 		if (!object->hit(ray_offset, ray_t, rec)) { return false; }
 		// offset the hit location in the oposite direction
@@ -50,6 +64,8 @@ public:
 		return true;
 	}
 	aabb bounding_box() const override { return bbox; }
+
+	friend class scene;
 private:
 	shared_ptr<hittable> object;
 	vec3 offset;
@@ -78,7 +94,7 @@ public:
 						y,
 						-sin_theta * x + cos_theta * z
 					);
-					for (int c = 0; c < 2; c++) {
+					for (int c = 0; c < 3; c++) {
 						min[c] = std::fmin(rotated[c], min[c]);
 						max[c] = std::fmax(rotated[c], max[c]);
 					}
@@ -88,6 +104,7 @@ public:
 		bbox = aabb(min, max);
 	}
 	bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+		RT_STAT(STAT_INSTANCE_TESTS);
 		auto origin = point3(
 			cos_theta * r.origin().x() - sin_theta * r.origin().z(),
 			r.origin().y(),
@@ -109,19 +126,24 @@ public:
 			-sin_theta * rec.p.x() + cos_theta * rec.p.z()
 		);
 
-		rec.normal = vec3(
-			cos_theta * rec.normal.x() + sin_theta * rec.normal.z(),
-			rec.normal.y(),
-			-sin_theta * rec.normal.x() + cos_theta * rec.normal.z()
-		);
+		rec.normal = rotate(rec.normal);
+		rec.dpdu = rotate(rec.dpdu);
+		rec.dpdv = rotate(rec.dpdv);
 		return true;
 	}
 	aabb bounding_box() const override { return bbox; }
+
+	friend class scene;
 private:
 	shared_ptr<hittable> object;
 	double sin_theta;
 	double cos_theta;
 	aabb bbox;
+
+	vec3 rotate(const vec3& v) const {
+		// Object space to world space.
+		return vec3(cos_theta * v.x() + sin_theta * v.z(), v.y(), -sin_theta * v.x() + cos_theta * v.z());
+	}
 };
 
 #endif // !HITTABLE_H
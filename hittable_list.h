@@ -21,6 +21,7 @@ public:
 	}
 
 	bool hit(const ray& r, interval ray_t, hit_record& rec) const override{
+		RT_STAT_ADD(STAT_LIST_TESTS, objects.size());
 		hit_record temp_rec;
 		bool hit_anything = false;
 		auto closest_so_far = ray_t.max;
@@ -0,0 +1,116 @@
+#ifndef IMAGE_REGISTRY_H
+#define IMAGE_REGISTRY_H
+
+#include "rtw_stb_image.h"
+#include "rtweekend.h"
+#include "trace.h"
+
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class image_registry {
+public:
+	// Process-wide cache of decoded images, keyed by the resolved file and the texel format it
+	// is stored in. Each file is decoded once, however many textures use it and however they
+	// spell its name; every caller shares the same read-only image. Safe to call from
+	// several threads: different files decode concurrently, and requests for a file being
+	// decoded wait for it.
+
+	static image_registry& global() {
+		static image_registry registry;
+		return registry;
+	}
+
+	image_registry() {
+		// Search the directory named by the RTW_IMAGES environment variable, if defined, then
+		// the current directory, then images/, then the parent's images/ subdirectory, and so
+		// on for six levels up.
+		if (auto imagedir = getenv("RTW_IMAGES")) search_path.push_back(imagedir);
+		search_path.push_back(".");
+		std::string prefix;
+		for (int level = 0; level <= 6; level++) {
+			search_path.push_back(prefix + "images");
+			prefix += "../";
+		}
+	}
+
+	void set_search_path(std::vector<std::string> directories) {
+		// Affects images requested after the call; images already loaded stay cached.
+		std::lock_guard<std::mutex> lock(mutex);
+		search_path = std::move(directories);
+	}
+
+	shared_ptr<const rtw_image> get(const std::string& filename, texel_format format = texel_format::srgb8) {
+		// A file that is not found is keyed by its name, so its error is reported once.
+		auto path = find(filename);
+		std::string key = filename;
+		if (!path.empty()) {
+			std::error_code error;
+			auto canonical = std::filesystem::weakly_canonical(path, error);
+			key = error ? path : canonical.string();
+			format = rtw_image::stored_format(path, format);
+		}
+
+		std::shared_ptr<entry> e;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			auto& slot = entries[key + '\0' + rtw_image::format_name(format)];
+			if (!slot) slot = std::make_shared<entry>();
+			e = slot;
+		}
+		std::call_once(e->once, [&]() { e->image = load(filename, path, format); });
+		return e->image;
+	}
+
+	std::string find(const std::string& filename) {
+		// Path of the first file of that name on the search path, or an empty string.
+		std::vector<std::string> directories;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			directories = search_path;
+		}
+
+		std::error_code error;
+		for (const auto& directory : directories) {
+			auto path = std::filesystem::path(directory) / filename;
+			if (std::filesystem::is_regular_file(path, error)) return path.string();
+		}
+		return "";
+	}
+
+	void preload(const std::vector<std::string>& filenames, texel_format format = texel_format::srgb8) {
+		// Decodes a scene's images in parallel before it is built.
+		#pragma omp parallel for schedule(dynamic)
+		for (int i = 0; i < int(filenames.size()); i++)
+			get(filenames[i], format);
+	}
+
+private:
+	struct entry {
+		std::once_flag once;
+		shared_ptr<const rtw_image> image;
+	};
+
+	std::mutex mutex;
+	std::vector<std::string> search_path;
+	std::unordered_map<std::string, std::shared_ptr<entry>> entries;
+
+	shared_ptr<const rtw_image> load(const std::string& filename, const std::string& path, texel_format format) {
+		trace_scope scope("load image", "texture");
+		auto image = make_shared<rtw_image>();
+		if (!path.empty() && image->load(path, format)) {
+			std::clog << "Loaded image '" << filename << "': " << image->width() << 'x' << image->height()
+					  << ' ' << rtw_image::format_name(image->format()) << ", " << image->memory_usage() / 1024 << " KB\n";
+			return image;
+		}
+
+		// An empty image makes image_texture return its debugging color.
+		std::cerr << "ERROR: Could not load image file '" << filename << "'.\n";
+		return image;
+	}
+};
+
+#endif // !IMAGE_REGISTRY_H
@@ -0,0 +1,56 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include "affine.h"
+#include "hittable.h"
+
+class instance : public hittable {
+public:
+	// Places a shared object (typically a bottom-level bvh_node) in the world with an
+	// arbitrary affine transform. Any number of instances can reference the same object, and
+	// a bvh_node over the instances acts as the top-level acceleration structure.
+	instance(shared_ptr<hittable> object, const affine& object_to_world)
+		: object(object), object_to_world(object_to_world), world_to_object(object_to_world.inverse())
+	{
+		bbox = object_to_world.transform_box(object->bounding_box());
+	}
+
+	bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+		// The direction is not renormalized, so t is the same in both spaces.
+		RT_STAT(STAT_INSTANCE_TESTS);
+		ray object_ray(
+			world_to_object.transform_point(r.origin()),
+			world_to_object.transform_vector(r.direction())
+		);
+		if (!object->hit(object_ray, ray_t, rec)) { return false; }
+
+		rec.p = object_to_world.transform_point(rec.p);
+		rec.normal = unit_vector(world_to_object.transform_vector_transposed(rec.normal));
+		rec.dpdu = object_to_world.transform_vector(rec.dpdu);
+		rec.dpdv = object_to_world.transform_vector(rec.dpdv);
+		return true;
+	}
+
+	aabb bounding_box() const override { return bbox; }
+
+	// Light sampling assumes a rigid transform; scaled instances do not preserve solid angle.
+	double pdf_value(const point3& origin, const vec3& direction) const override {
+		return object->pdf_value(
+			world_to_object.transform_point(origin),
+			world_to_object.transform_vector(direction)
+		);
+	}
+
+	vec3 random(const point3& origin) const override {
+		return object_to_world.transform_vector(object->random(world_to_object.transform_point(origin)));
+	}
+
+	friend class scene;
+private:
+	shared_ptr<hittable> object;
+	affine object_to_world;
+	affine world_to_object;
+	aabb bbox;
+};
+
+#endif // !INSTANCE_H
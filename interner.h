@@ -0,0 +1,143 @@
+#ifndef INTERNER_H
+#define INTERNER_H
+
+#include "arena.h"
+#include "material.h"
+#include "texture.h"
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <typeinfo>
+#include <vector>
+
+class interner {
+public:
+	// Builds materials and textures through an arena, returning the existing object when one
+	// of the same type was already made from the same arguments. Arguments are compared by
+	// value (numbers, colors, strings such as image file names) except for shared_ptrs, which
+	// compare by address; since nested textures are interned first, equal definitions end up
+	// with equal addresses too. The table is only needed while the scene is built: clear()
+	// it before rendering. The interned objects belong to the arena.
+	interner(arena& objects) : objects(objects) {}
+
+	template <typename T, typename... Args>
+	shared_ptr<T> intern(const Args&... args) {
+		key.clear();
+		const std::type_info* type = &typeid(T);
+		append_bytes('t', &type, sizeof(type));
+		(append_key(args), ...);
+
+		auto& counts = std::is_base_of<material, T>::value ? material_counts : texture_counts;
+		counts.requested++;
+
+		auto hash = std::hash<std::string_view>()(key);
+		auto& found = find_slot(hash);
+		if (found.object) return shared_ptr<T>(shared_ptr<T>(), static_cast<T*>(found.object));
+
+		counts.unique++;
+		auto object = objects.make<T>(args...);
+		found = slot{ hash, key_bytes.size(), key.size(), object.get() };
+		key_bytes.insert(key_bytes.end(), key.begin(), key.end());
+		if (++entries * 10 > slots.size() * 7) grow();
+		return object;
+	}
+
+	void clear() {
+		// Frees the table; the counts are kept for report().
+		std::vector<slot>().swap(slots);
+		std::vector<char>().swap(key_bytes);
+		std::string().swap(key);
+		entries = 0;
+	}
+
+	void report(std::ostream& out) const {
+		out << "Interned materials: " << material_counts.requested << " -> " << material_counts.unique
+			<< ", textures: " << texture_counts.requested << " -> " << texture_counts.unique << '\n';
+	}
+
+private:
+	struct counts { size_t requested = 0, unique = 0; };
+	struct slot {
+		size_t hash;
+		size_t offset, size;	// Key location in key_bytes
+		void* object;			// Null for an empty slot
+	};
+
+	arena& objects;
+	std::vector<slot> slots = std::vector<slot>(64);	// Open addressing, power of two size
+	std::vector<char> key_bytes;						// All keys, back to back
+	std::string key;									// Key of the current request
+	size_t entries = 0;
+	counts material_counts, texture_counts;
+
+	slot& find_slot(size_t hash) {
+		// Linear probing; returns the matching slot or the empty slot to insert into.
+		if (slots.empty()) slots.resize(64);
+		auto mask = slots.size() - 1;
+		for (auto i = hash & mask;; i = (i + 1) & mask) {
+			auto& s = slots[i];
+			if (!s.object) return s;
+			if (s.hash == hash && s.size == key.size()
+				&& std::memcmp(&key_bytes[s.offset], key.data(), key.size()) == 0)
+				return s;
+		}
+	}
+
+	void grow() {
+		std::vector<slot> old(2 * slots.size());
+		old.swap(slots);
+		auto mask = slots.size() - 1;
+		for (const auto& s : old) {
+			if (!s.object) continue;
+			auto i = s.hash & mask;
+			while (slots[i].object) i = (i + 1) & mask;
+			slots[i] = s;
+		}
+	}
+
+	// Each argument is tagged with its kind so that differently typed argument lists can never
+	// produce the same key.
+	void append_bytes(char kind, const void* data, size_t size) {
+		key.push_back(kind);
+		key.append(static_cast<const char*>(data), size);
+	}
+
+	static double canonical(double x) {
+		// Equal values must have equal bytes: -0 becomes 0 and every NaN the same NaN.
+		if (x == 0) return 0.0;
+		if (std::isnan(x)) return std::numeric_limits<double>::quiet_NaN();
+		return x;
+	}
+
+	void append_key(const vec3& v) {
+		double e[3] = { canonical(v.x()), canonical(v.y()), canonical(v.z()) };
+		append_bytes('v', e, sizeof(e));
+	}
+
+	void append_key(const char* s) {
+		append_bytes('s', s, std::strlen(s) + 1);
+	}
+
+	void append_key(const std::string& s) {
+		append_key(s.c_str());
+	}
+
+	template <typename U>
+	void append_key(const shared_ptr<U>& p) {
+		const void* address = p.get();
+		append_bytes('p', &address, sizeof(address));
+	}
+
+	template <typename U>
+	void append_key(const U& value) {
+		static_assert(std::is_arithmetic<U>::value, "interner: unsupported constructor argument");
+		double d = canonical(double(value));
+		append_bytes('d', &d, sizeof(d));
+	}
+};
+
+#endif // !INTERNER_H
@@ -0,0 +1,316 @@
+// Microbenchmarks of the renderer's hot kernels: intersection, texturing, scattering and
+// sampling, each timed in isolation over fixed pseudo-random inputs. Prints ns/op and
+// throughput, optionally writes them as JSON, and compares against a saved JSON baseline.
+
+#include "rtweekend.h"
+
+#include "aabb.h"
+#include "bvh.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "pdf.h"
+#include "quad.h"
+#include "sphere.h"
+#include "texture.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+struct bench_result {
+	std::string name;
+	double ns_per_op;
+	size_t ops;		// Operations in the best run
+};
+
+struct bench_options {
+	unsigned seed = 1;
+	double min_time = 0.05;		// Seconds per timed run
+	int runs = 5;
+	std::string filter;
+};
+
+static volatile double sink;	// Keeps the benchmarked work from being optimized away
+
+static const size_t input_count = 4096;
+
+template <typename F>
+static void run(const bench_options& options, std::vector<bench_result>& results, const char* name, F&& op) {
+	// Times op(i) for i = 0, 1, ... (callers index their inputs by i % input_count). The
+	// count is doubled until a run takes min_time; the best of `runs` runs is reported.
+	if (!options.filter.empty() && std::string(name).find(options.filter) == std::string::npos) return;
+
+	auto time = [&](size_t count) {
+		double total = 0;
+		auto start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < count; i++) total += op(i);
+		auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		sink = sink + total;
+		return elapsed;
+	};
+
+	size_t count = input_count;
+	while (time(count) < options.min_time && count < (size_t(1) << 34)) count *= 2;
+	double best = infinity;
+	for (int r = 0; r < options.runs; r++) best = std::fmin(best, time(count));
+
+	results.push_back({ name, best * 1e9 / count, count });
+	std::cout << name << ": " << results.back().ns_per_op << " ns/op, " << count / best / 1e6 << " M ops/s\n";
+}
+
+static std::vector<ray> make_rays(const point3& target, double target_radius, double distance) {
+	// Rays from a sphere of the given distance around the target, aimed at random points of a
+	// cube twice its radius, so that about half of them miss a sphere of that radius.
+	std::vector<ray> rays(input_count);
+	for (auto& r : rays) {
+		auto origin = target + distance * random_unit_vector();
+		auto aim = target + 2 * target_radius * vec3::random(-1, 1);
+		r = ray(origin, aim - origin);
+	}
+	return rays;
+}
+
+static std::vector<hit_record> make_hits(const hittable& object, const std::vector<ray>& rays,
+										 std::vector<ray>& hit_rays) {
+	// The records of the rays that hit the object, and those rays, for shading benchmarks.
+	std::vector<hit_record> hits;
+	for (const auto& r : rays) {
+		hit_record rec;
+		if (object.hit(r, interval(0.001, infinity), rec)) {
+			hits.push_back(rec);
+			hit_rays.push_back(r);
+		}
+	}
+	return hits;
+}
+
+static void run_all(const bench_options& options, std::vector<bench_result>& results) {
+	// Inputs are regenerated from the seed before each group, so that a benchmark's inputs do
+	// not depend on which others run.
+	auto reseed = [&] { std::srand(options.seed); };
+	auto hit_t = interval(0.001, infinity);
+
+	// Intersection
+	{
+		reseed();
+		auto mat = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+		sphere ball(point3(0, 0, 0), 1, mat);
+		quad square(point3(-1, -1, 0), vec3(2, 0, 0), vec3(0, 2, 0), mat);
+		aabb box(point3(-1, -1, -1), point3(1, 1, 1));
+		auto rays = make_rays(point3(0, 0, 0), 1, 10);
+
+		hit_record rec;
+		run(options, results, "sphere::hit", [&](size_t i) {
+			return ball.hit(rays[i % input_count], hit_t, rec) ? rec.t : 0.0;
+		});
+		run(options, results, "quad::hit", [&](size_t i) {
+			return square.hit(rays[i % input_count], hit_t, rec) ? rec.t : 0.0;
+		});
+		run(options, results, "aabb::hit", [&](size_t i) {
+			return box.hit(rays[i % input_count], hit_t) ? 1.0 : 0.0;
+		});
+	}
+	{
+		// A BVH over 500 small spheres scattered through a box, as in the bouncing spheres scene.
+		reseed();
+		auto mat = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+		hittable_list list;
+		for (int k = 0; k < 500; k++)
+			list.add(make_shared<sphere>(point3(vec3::random(-10, 10)), random_double(0.2, 0.5), mat));
+		bvh_node bvh(list);
+		auto rays = make_rays(point3(0, 0, 0), 10, 30);
+
+		hit_record rec;
+		run(options, results, "bvh_node::hit (500 spheres)", [&](size_t i) {
+			return bvh.hit(rays[i % input_count], hit_t, rec) ? rec.t : 0.0;
+		});
+	}
+
+	// Textures
+	{
+		reseed();
+		perlin noise;
+		std::vector<point3> points(input_count);
+		for (auto& p : points) p = point3(vec3::random(-3, 3));
+		run(options, results, "perlin::turb (7 octaves)", [&](size_t i) {
+			return noise.turb(points[i % input_count], 7);
+		});
+
+		image_texture earth("earthmap.jpg");
+		std::vector<vec3> uvs(input_count);
+		for (auto& uv : uvs) uv = vec3(random_double(), random_double(), std::ldexp(1.0, -random_int(4, 12)));
+		run(options, results, "image_texture::value", [&](size_t i) {
+			const auto& uv = uvs[i % input_count];
+			return earth.value(uv.x(), uv.y(), point3(0, 0, 0)).x();
+		});
+		run(options, results, "image_texture::value (filtered)", [&](size_t i) {
+			const auto& uv = uvs[i % input_count];
+			return earth.value(uv.x(), uv.y(), point3(0, 0, 0), uv.z(), uv.z()).x();
+		});
+	}
+
+	// Materials, scattering rays that hit a unit sphere
+	{
+		reseed();
+		sphere ball(point3(0, 0, 0), 1, nullptr);
+		std::vector<ray> rays;
+		auto hits = make_hits(ball, make_rays(point3(0, 0, 0), 1, 10), rays);
+
+		struct named_material { const char* name; shared_ptr<material> mat; };
+		named_material materials[] = {
+			{ "lambertian::scatter", make_shared<lambertian>(color(0.5, 0.5, 0.5)) },
+			{ "lambertian::scatter (noise)", make_shared<lambertian>(make_shared<noise_texture>(4, 7)) },
+			{ "metal::scatter", make_shared<metal>(color(0.8, 0.8, 0.8), 0.3) },
+			{ "dielectric::scatter", make_shared<dielectric>(1.5) },
+			{ "isotropic::scatter", make_shared<isotropic>(color(0.5, 0.5, 0.5)) },
+		};
+		for (const auto& m : materials) {
+			scatter_record srec;
+			run(options, results, m.name, [&](size_t i) {
+				auto k = i % hits.size();
+				m.mat->scatter(rays[k], hits[k], srec);
+				return srec.attenuation.x();
+			});
+		}
+	}
+
+	// Sampling
+	{
+		reseed();
+		std::vector<vec3> directions(input_count);
+		for (auto& d : directions) d = random_unit_vector();
+
+		hittable_list light;
+		light.add(make_shared<quad>(point3(-1, 5, -1), vec3(2, 0, 0), vec3(0, 0, 2), nullptr));
+		auto origin = point3(0, 0, 0);
+
+		struct named_pdf { const char* name; const char* detail; shared_ptr<pdf> p; };
+		auto cosine = make_shared<cosine_pdf>(vec3(0, 1, 0));
+		auto toward_light = make_shared<hittable_pdf>(light, origin);
+		named_pdf pdfs[] = {
+			{ "sphere_pdf", "", make_shared<sphere_pdf>() },
+			{ "cosine_pdf", "", cosine },
+			{ "hittable_pdf", " (quad)", toward_light },
+			{ "mixture_pdf", " (quad, cosine)", make_shared<mixture_pdf>(toward_light, cosine) },
+		};
+		for (const auto& p : pdfs) {
+			auto name = std::string(p.name);
+			run(options, results, (name + "::generate" + p.detail).c_str(), [&](size_t) { return p.p->generate().x(); });
+			run(options, results, (name + "::value" + p.detail).c_str(), [&](size_t i) {
+				return p.p->value(directions[i % input_count]);
+			});
+		}
+
+		run(options, results, "random_double", [](size_t) { return random_double(); });
+	}
+}
+
+static void write_json(std::ostream& out, const bench_options& options, const std::vector<bench_result>& results) {
+	out << "{\n  \"seed\": " << options.seed << ",\n  \"benchmarks\": [\n";
+	for (size_t i = 0; i < results.size(); i++) {
+		const auto& r = results[i];
+		out << "    { \"name\": \"" << r.name << "\", \"ns_per_op\": " << r.ns_per_op
+			<< ", \"ops_per_second\": " << 1e9 / r.ns_per_op
+			<< ", \"ops\": " << r.ops << " }" << (i + 1 < results.size() ? "," : "") << '\n';
+	}
+	out << "  ]\n}\n";
+}
+
+static std::vector<bench_result> read_json(std::istream& in) {
+	// Reads the benchmarks back from a file written by write_json; not a general JSON parser.
+	std::stringstream buffer;
+	buffer << in.rdbuf();
+	auto text = buffer.str();
+
+	std::vector<bench_result> results;
+	const std::string name_key = "\"name\": \"", ns_key = "\"ns_per_op\": ";
+	for (size_t at = text.find(name_key); at != std::string::npos; at = text.find(name_key, at)) {
+		at += name_key.size();
+		auto end = text.find('"', at);
+		auto ns = text.find(ns_key, end);
+		if (end == std::string::npos || ns == std::string::npos) break;
+		results.push_back({ text.substr(at, end - at), std::strtod(text.c_str() + ns + ns_key.size(), nullptr), 0 });
+		at = end;
+	}
+	return results;
+}
+
+static int compare(const std::vector<bench_result>& results, const std::vector<bench_result>& baseline,
+				   double threshold) {
+	// Prints each benchmark's change against the baseline and returns how many got slower by
+	// more than `threshold` (a fraction).
+	int regressions = 0;
+	std::cout << "\nAgainst baseline (threshold " << threshold * 100 << "%):\n";
+	for (const auto& r : results) {
+		auto base = std::find_if(baseline.begin(), baseline.end(), [&](const bench_result& b) { return b.name == r.name; });
+		if (base == baseline.end() || base->ns_per_op <= 0) {
+			std::cout << "  " << r.name << ": not in baseline\n";
+			continue;
+		}
+		auto change = r.ns_per_op / base->ns_per_op - 1;
+		bool regressed = change > threshold;
+		regressions += regressed;
+		std::cout << "  " << r.name << ": " << base->ns_per_op << " -> " << r.ns_per_op << " ns/op ("
+				  << (change >= 0 ? "+" : "") << change * 100 << "%)" << (regressed ? "  REGRESSION" : "") << '\n';
+	}
+	return regressions;
+}
+
+int main(int argc, char** argv) {
+	// Usage: kernel_bench [--json out.json] [--baseline base.json] [--threshold fraction]
+	//                     [--filter substring] [--min-time seconds] [--runs n] [--seed n]
+	// Exits with status 1 if any benchmark regressed against the baseline.
+	bench_options options;
+	std::string json_path, baseline_path;
+	double threshold = 0.1;
+	for (int i = 1; i < argc; i++) {
+		auto arg = std::string(argv[i]);
+		if (i + 1 >= argc) {
+			std::cerr << "ERROR: Missing value for '" << arg << "'.\n";
+			return 2;
+		}
+		auto value = argv[++i];
+		if (arg == "--json") json_path = value;
+		else if (arg == "--baseline") baseline_path = value;
+		else if (arg == "--threshold") threshold = std::atof(value);
+		else if (arg == "--filter") options.filter = value;
+		else if (arg == "--min-time") options.min_time = std::atof(value);
+		else if (arg == "--runs") options.runs = std::max(1, std::atoi(value));
+		else if (arg == "--seed") options.seed = unsigned(std::atoi(value));
+		else {
+			std::cerr << "ERROR: Unknown option '" << arg << "'.\n";
+			return 2;
+		}
+	}
+
+	std::vector<bench_result> baseline;
+	if (!baseline_path.empty()) {
+		std::ifstream in(baseline_path);
+		if (!in) {
+			std::cerr << "ERROR: Could not read baseline '" << baseline_path << "'.\n";
+			return 2;
+		}
+		baseline = read_json(in);
+	}
+
+	std::vector<bench_result> results;
+	run_all(options, results);
+
+	if (!json_path.empty()) {
+		std::ofstream out(json_path);
+		write_json(out, options, results);
+		if (!out) {
+			std::cerr << "ERROR: Could not write '" << json_path << "'.\n";
+			return 2;
+		}
+	}
+
+	if (!baseline_path.empty() && compare(results, baseline, threshold) > 0) return 1;
+	return 0;
+}
@@ -1,299 +1,65 @@
 #include "rtweekend.h"
 
-#include "bvh.h"
-#include "camera.h"
-#include "hittable.h"
-#include "hittable_list.h"
-#include "material.h"
-#include "sphere.h"
-#include "aabb.h"
-#include "texture.h"
-#include "perlin.h"
-#include "quad.h"
-#include "onb.h"
-#include "pdf.h"
-
-void spheres() {
-	hittable_list world;
-    hittable_list lights;
-    
-    auto checker = make_shared<checker_texture>(1.28, color(.4, .4, .4), color(.6, .6, .6));
-    world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, make_shared<lambertian>(checker)));
-
-    for (int a = -11; a < 11; a++) {
-        for (int b = -11; b < 11; b++) {
-            auto choose_mat = random_double();
-            point3 center(a + 0.9 * random_double(), 0.2, b + 0.9 * random_double());
-
-            if ((center - point3(4, 0.2, 0)).length() > 0.9) {
-                shared_ptr<material> sphere_material;
-
-                if (choose_mat < 0.8) {
-                    // diffuse
-                    auto albedo = color::random() * color::random();
-                    sphere_material = make_shared<lambertian>(albedo);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
-                }
-                else if (choose_mat < 0.95) {
-                    // metal
-                    auto albedo = color::random(0.5, 1);
-                    auto fuzz = random_double(0, 0.5);
-                    sphere_material = make_shared<metal>(albedo, fuzz);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
-                }
-                else {
-                    // glass
-                    sphere_material = make_shared<dielectric>(1.5);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
-                }
-            }
-        }
-    }
-
-    auto material1 = make_shared<dielectric>(1.5);
-    world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
-
-    auto material2 = make_shared<lambertian>(color(0.4, 0.2, 0.1));
-    world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, material2));
-
-    auto material3 = make_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
-    world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
-
-    world = hittable_list(make_shared<bvh_node>(world));
-
-    camera cam;
-
-    cam.aspect_ratio = 16.0 / 9.0;
-    cam.image_width = 800;
-    cam.samples_per_pixel = 40;
-    cam.max_depth = 20;
-
-    cam.vfov = 20;
-    cam.lookfrom = point3(13, 2, 3);
-    cam.lookat = point3(0, 0, 0);
-    cam.vup = vec3(0, 1, 0);
-    cam.background = color(0.70, 0.80, 1.00);
-
-    cam.defocus_angle = 0.6;
-    cam.focus_dist = 10.0;
-
-	cam.render(world, lights);
-}
-
-void checkered_spheres() {
-    hittable_list world;
-    hittable_list lights;
-
-    auto checker = make_shared<checker_texture>(0.32, color(.2, .3, .1), color(.9, .9, .9));
-
-    world.add(make_shared<sphere>(point3(0, -10, 0), 10, make_shared<lambertian>(checker)));
-    world.add(make_shared<sphere>(point3(0, 10, 0), 10, make_shared<lambertian>(checker)));
-
-    camera cam;
-
-    cam.aspect_ratio = 16.0 / 9.0;
-    cam.image_width = 400;
-    cam.samples_per_pixel = 50;
-    cam.max_depth = 20;
-    cam.background = color(0.70, 0.80, 1.00);
-
-    cam.vfov = 20;
-    cam.lookfrom = point3(13, 2, 3);
-    cam.lookat = point3(0, 0, 0);
-    cam.vup = vec3(0, 1, 0);
-
-    cam.defocus_angle = 0;
-
-    cam.render(world, lights);
-}
-
-void earth() {
-    auto earth_texture = make_shared<image_texture>("earthmap.jpg");
-    auto earth_surface = make_shared<lambertian>(earth_texture);
-    auto globe = make_shared<sphere>(point3(0, 0, 0), 2, earth_surface);
-    hittable_list lights;
-
-    camera cam;
-
-    cam.aspect_ratio = 16.0 / 9.0;
-    cam.image_width = 400;
-    cam.samples_per_pixel = 100;
-    cam.max_depth = 50;
-    cam.background = color(0.70, 0.80, 1.00);
-
-    cam.vfov = 20;
-    cam.lookfrom = point3(0, 0, 12);
-    cam.lookat = point3(0, 0, 0);
-    cam.vup = vec3(0, 1, 0);
-
-    cam.defocus_angle = 0;
-
-    cam.render(hittable_list(globe), lights);
-}
-
-void perlin_spheres() {
-    hittable_list world;
-    hittable_list lights;
-
-    auto pertext = make_shared<noise_texture>(4, 5);
-    world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, make_shared<lambertian>(pertext)));
-    world.add(make_shared<sphere>(point3(0, 2, 0), 2, make_shared<lambertian>(pertext)));
-
-    camera cam;
-
-    cam.aspect_ratio = 16.0 / 9.0;
-    cam.image_width = 400;
-    cam.samples_per_pixel = 100;
-    cam.max_depth = 50;
-    cam.background = color(0.70, 0.80, 1.00);
-
-    cam.vfov = 20;
-    cam.lookfrom = point3(13, 2, 3);
-    cam.lookat = point3(0, 0, 0);
-    cam.vup = vec3(0, 1, 0);
-
-    cam.defocus_angle = 0;
-
-    cam.render(world, lights);
-}
-
-void quads() {
-    hittable_list world;
-    hittable_list lights;
-
-    // Materials
-    auto left_red = make_shared<lambertian>(color(1.0, 0.2, 0.2));
-    auto back_green = make_shared<lambertian>(color(0.2, 1.0, 0.2));
-    auto right_blue = make_shared<lambertian>(color(0.2, 0.2, 1.0));
-    auto upper_orange = make_shared<lambertian>(color(1.0, 0.5, 0.0));
-    auto lower_teal = make_shared<lambertian>(color(0.2, 0.8, 0.8));
-
-    // Quads
-    world.add(make_shared<quad>(point3(-3, -2, 5), vec3(0, 0, -4), vec3(0, 4, 0), left_red));
-    world.add(make_shared<quad>(point3(-2, -2, 0), vec3(4, 0, 0), vec3(0, 4, 0), back_green));
-    world.add(make_shared<quad>(point3(3, -2, 1), vec3(0, 0, 4), vec3(0, 4, 0), right_blue));
-    world.add(make_shared<quad>(point3(-2, 3, 1), vec3(4, 0, 0), vec3(0, 0, 4), upper_orange));
-    world.add(make_shared<quad>(point3(-2, -3, 5), vec3(4, 0, 0), vec3(0, 0, -4), lower_teal));
-
-    camera cam;
-
-    cam.aspect_ratio = 1.0;
-    cam.image_width = 400;
-    cam.samples_per_pixel = 100;
-    cam.max_depth = 50;
-    cam.background = color(0.70, 0.80, 1.00);
-
-    cam.vfov = 80;
-    cam.lookfrom = point3(0, 0, 9);
-    cam.lookat = point3(0, 0, 0);
-    cam.vup = vec3(0, 1, 0);
-
-    cam.defocus_angle = 0;
-
-    cam.render(world, lights);
-}
-
-void simple_light() {
-    hittable_list world;
-    hittable_list lights;
-
-    auto pertext = make_shared<noise_texture>(4, 7);
-    world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, make_shared<lambertian>(pertext)));
-    world.add(make_shared<sphere>(point3(0, 2, 0), 2, make_shared<lambertian>(pertext)));
-
-    auto difflight = make_shared<diffuse_light>(color(4, 4, 4));
-    world.add(make_shared<quad>(point3(3, 1, -2), vec3(2, 0, 0), vec3(0, 2, 0), difflight));
-    lights.add(make_shared<quad>(point3(3, 1, -2), vec3(2, 0, 0), vec3(0, 2, 0), difflight));
-    camera cam;
-
-    cam.aspect_ratio = 16.0 / 9.0;
-    cam.image_width = 400;
-    cam.samples_per_pixel = 100;
-    cam.max_depth = 50;
-    cam.background = color(0, 0, 0);
-
-    cam.vfov = 20;
-    cam.lookfrom = point3(26, 3, 6);
-    cam.lookat = point3(0, 2, 0);
-    cam.vup = vec3(0, 1, 0);
-
-    cam.defocus_angle = 0;
-
-    cam.render(world, lights);
-}
-
-void cornell_box() {
-    //world
-    hittable_list world;
-
-    //materials
-    auto red = make_shared<lambertian>(color(.65, .05, .05));
-    auto white = make_shared<lambertian>(color(.73, .73, .73));
-    auto green = make_shared<lambertian>(color(.12, .45, .15));
-    auto light = make_shared<diffuse_light>(color(15, 15, 15));
-
-    //walls
-    world.add(make_shared<quad>(point3(555, 0, 0), vec3(0, 555, 0), vec3(0, 0, 555), green));
-    world.add(make_shared<quad>(point3(0, 0, 0), vec3(0, 555, 0), vec3(0, 0, 555), red));
-    world.add(make_shared<quad>(point3(0, 0, 0), vec3(555, 0, 0), vec3(0, 0, 555), white));
-    world.add(make_shared<quad>(point3(555, 555, 555), vec3(-555, 0, 0), vec3(0, 0, -555), white));
-    world.add(make_shared<quad>(point3(0, 0, 555), vec3(555, 0, 0), vec3(0, 555, 0), white));
-
-    //light
-    world.add(make_shared<quad>(point3(343, 554, 332), vec3(-130, 0, 0), vec3(0, 0, -105), light));
-
-    //box1
-    shared_ptr<hittable> box1 = box(point3(0, 0, 0), point3(165, 330, 165), white);
-    //shared_ptr<material> aluminum = make_shared<metal>(color(0.8, 0.85, 0.88), 0.0);
-    //shared_ptr<hittable> box1 = box(point3(0, 0, 0), point3(165, 330, 165), aluminum);
-    box1 = make_shared<rotate_y>(box1, 15);
-    box1 = make_shared<translate>(box1, vec3(265, 0, 295));
-    world.add(box1);
-
-    // Glass Sphere
-    auto glass = make_shared<dielectric>(1.5);
-    world.add(make_shared<sphere>(point3(190, 90, 190), 90, glass));
-
-    ////box2
-    //shared_ptr<hittable> box2 = box(point3(0, 0, 0), point3(165, 165, 165), white);
-    //box2 = make_shared<rotate_y>(box2, -18);
-    //box2 = make_shared<translate>(box2, vec3(130, 0, 65));
-    //world.add(box2);
-
-    //light list
-    auto empty_material = shared_ptr<material>();    
-    hittable_list lights;
-    lights.add(
-        make_shared<quad>(point3(343, 554, 332), vec3(-130, 0, 0), vec3(0, 0, -105), empty_material));
-    lights.add(make_shared<sphere>(point3(190, 90, 190), 90, empty_material));
-
-    //camera
-    camera cam;
-
-    cam.aspect_ratio = 1.0;
-    cam.image_width = 400;
-    cam.samples_per_pixel = 20;
-    cam.max_depth = 20;
-    cam.background = color(0, 0, 0);
-
-    cam.vfov = 40;
-    cam.lookfrom = point3(278, 278, -800);
-    cam.lookat = point3(278, 278, 0);
-    cam.vup = vec3(0, 1, 0);
-
-    cam.defocus_angle = 0;
-
-    cam.render(world, lights);
-}
+#include "scenes.h"
 
 int main() {
+    // With RT_TRACE set to a path, a Chrome trace of the run is written there. With RT_PREVIEW
+    // set, the image renders in passes of doubling sample counts, each written there once done.
+    // RT_BUDGET sets a time budget in seconds. RT_CROP=x0,y0,x1,y1 renders only pixels
+    // [x0, x1) x [y0, y1), and RT_TILES=size,tx0,ty0,tx1,ty1 only those tiles of the given size;
+    // merge_tiles assembles such images into the frame. RT_STREAM=rows writes the image in bands
+    // of that many rows as they are done, without keeping all of it. RT_DENOISE filters the image.
+    auto trace_path = std::getenv("RT_TRACE");
+    auto preview_path = std::getenv("RT_PREVIEW");
+    auto budget = std::getenv("RT_BUDGET");
+    auto crop = std::getenv("RT_CROP");
+    auto tiles = std::getenv("RT_TILES");
+    auto stream = std::getenv("RT_STREAM");
+    auto denoise = std::getenv("RT_DENOISE");
+    if (trace_path) tracer::start();
+
+    scene_setup s;
+    {
+    trace_scope scope("build scene", "scene");
     switch (1) {
-        case 1: spheres(); break;
-        case 2: checkered_spheres(); break;
-        case 3: earth(); break;
-        case 4: perlin_spheres(); break;
-        case 5: quads(); break;
-        case 6: simple_light(); break;    
-        case 7: cornell_box(); break;
+        case 1: spheres(s); break;
+        case 2: checkered_spheres(s); break;
+        case 3: earth(s); break;
+        case 4: perlin_spheres(s); break;
+        case 5: quads(s); break;
+        case 6: simple_light(s); break;    
+        case 7: cornell_box(s); break;
+        case 8: instances(s); break;
+        case 9: particles(s); break;
+        case 10: million_spheres(s); break;
+        case 11: earth_out_of_core(s); break;
+        case 12: perlin_spheres(s, true); break;
+        case 13: simple_light(s, true); break;
+    }
+    }
+    if (preview_path) {
+        s.cam.progressive = PROGRESSIVE_DOUBLING;
+        s.cam.preview_path = preview_path;
+        s.cam.preview_interval = 0;
+    }
+    if (budget) s.cam.time_budget = std::atof(budget);
+    if (stream) s.cam.stream_rows = std::atoi(stream);
+    if (denoise) s.cam.denoise = true;
+    auto& r = s.cam.crop;
+    if (crop && std::sscanf(crop, "%d,%d,%d,%d", &r.x0, &r.y0, &r.x1, &r.y1) != 4)
+        std::cerr << "ERROR: RT_CROP should be x0,y0,x1,y1.\n";
+    int size, tx0, ty0, tx1, ty1;
+    if (tiles) {
+        if (std::sscanf(tiles, "%d,%d,%d,%d,%d", &size, &tx0, &ty0, &tx1, &ty1) == 5)
+            s.cam.crop_to_tiles(size, tx0, ty0, tx1, ty1);
+        else
+            std::cerr << "ERROR: RT_TILES should be size,tx0,ty0,tx1,ty1.\n";
+    }
+    s.cam.render(s.world, s.lights);
+    if (s.after_render) s.after_render();
+
+    if (trace_path) {
+        tracer::stop();
+        tracer::write(trace_path);
     }
 }
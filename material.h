@@ -29,6 +29,18 @@ public:
 
 	virtual color emitted(const ray& r_in, const hit_record& rec, double u, double v, const point3& p)
 		 const { return color(0, 0, 0); }
+
+	virtual color surface_albedo(const ray& r_in, const hit_record& rec) const {
+		// The surface's color, without lighting, for guiding the denoiser.
+		return color(1, 1, 1);
+	}
+
+protected:
+	static ray specular_ray(const ray& r_in, const hit_record& rec, const vec3& direction) {
+		// Specular bounces keep the incoming ray's cone, starting as wide as it was at the hit
+		// (surface curvature is ignored). Other bounces start new rays without one.
+		return ray(rec.p, direction, r_in.cone_width(rec.t), r_in.cone_spread());
+	}
 };
 
 class lambertian : public material {
@@ -37,16 +49,26 @@ public:
 	lambertian(shared_ptr<texture> tex) : tex(tex) {}
 
 	bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const override {
-		srec.attenuation = tex->value(rec.u, rec.v, rec.p);
+		RT_STAT(STAT_LAMBERTIAN_SCATTERS);
+		double du, dv;
+		rec.texture_footprint(r_in, du, dv);
+		srec.attenuation = tex->value(rec.u, rec.v, rec.p, du, dv);
 		srec.pdf_ptr = make_shared<cosine_pdf>(rec.normal);
 		srec.skip_pdf = false;
 		return true;
 	}
+	color surface_albedo(const ray& r_in, const hit_record& rec) const override {
+		double du, dv;
+		rec.texture_footprint(r_in, du, dv);
+		return tex->value(rec.u, rec.v, rec.p, du, dv);
+	}
 	double scattering_pdf(const ray& r_in, const hit_record& rec, const ray& scattered)
 	const override{
 		double cos_theta = dot(rec.normal, unit_vector(scattered.direction()));
 		return cos_theta < 0 ? 0 : cos_theta / pi;
 	}
+
+	friend class compiled_scene;
 private:
 	shared_ptr<texture> tex;
 };
@@ -58,15 +80,20 @@ public :
 
 	bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec)
 	const override {
+		RT_STAT(STAT_METAL_SCATTERS);
 		vec3 reflected = reflect(r_in.direction(), rec.normal);
 		reflected = unit_vector(reflected) + (random_unit_vector() * fuzz);
 
 		srec.attenuation = albedo;
 		srec.pdf_ptr = nullptr;
 		srec.skip_pdf = true;
-		srec.skip_pdf_ray = ray(rec.p, reflected);
+		srec.skip_pdf_ray = specular_ray(r_in, rec, reflected);
 		return true;
 	}
+
+	color surface_albedo(const ray& r_in, const hit_record& rec) const override { return albedo; }
+
+	friend class compiled_scene;
 private:
 	color albedo;
 	double fuzz;
@@ -79,6 +106,7 @@ public:
 
 	bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec)
 		const override {
+		RT_STAT(STAT_DIELECTRIC_SCATTERS);
 		srec.attenuation = color(1.0, 1.0, 1.0);
 		srec.pdf_ptr = nullptr;
 		srec.skip_pdf = true;
@@ -94,9 +122,11 @@ public:
 			direction = reflect(unit_direction, rec.normal);
 		else
 			direction = refract(unit_direction, rec.normal, ri);
-		srec.skip_pdf_ray = ray(rec.p, direction);
+		srec.skip_pdf_ray = specular_ray(r_in, rec, direction);
 		return true;
 	}
+
+	friend class compiled_scene;
 private:
 	double refract_index;
 	static double reflectance(double cos, double ri) {
@@ -115,9 +145,19 @@ public:
 		const override {
 		if (!rec.front_face)
 			return color(0, 0, 0);
-		return tex->value(u, v, p);
+		double du, dv;
+		rec.texture_footprint(r_in, du, dv);
+		return tex->value(u, v, p, du, dv);
 	}
 
+	color surface_albedo(const ray& r_in, const hit_record& rec) const override {
+		// The emission, clamped to what a reflectance could be.
+		static const interval unit(0, 1);
+		auto e = tex->value(rec.u, rec.v, rec.p);
+		return color(unit.clamp(e.x()), unit.clamp(e.y()), unit.clamp(e.z()));
+	}
+
+	friend class compiled_scene;
 private:
 	shared_ptr<texture> tex;
 };
@@ -129,17 +169,23 @@ public:
 	isotropic(shared_ptr<texture> tex) : tex(tex) {}
 
 	bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const override {
+		RT_STAT(STAT_ISOTROPIC_SCATTERS);
 		srec.attenuation = tex->value(rec.u, rec.v, rec.p);
 		srec.pdf_ptr = make_shared<sphere_pdf>();
 		srec.skip_pdf = false;
 		return true;
 	}
 
+	color surface_albedo(const ray& r_in, const hit_record& rec) const override {
+		return tex->value(rec.u, rec.v, rec.p);
+	}
+
 	double scattering_pdf(const ray& r_in, const hit_record& rec, const ray& scattered)
 		const override {
 		return 1 / (4 * pi);
 	}
 
+	friend class compiled_scene;
 private:
 	shared_ptr<texture> tex;
 };
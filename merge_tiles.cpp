@@ -0,0 +1,109 @@
+// Assembles cropped renders into the full frame. Each cropped PPM written by camera says where
+// it belongs in a "# crop x y of width height" comment; images without one cover the frame from
+// its top left corner. Pixels no image covers are black and reported.
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+struct part {
+	std::string path;
+	int x = 0, y = 0;				// Offset in the frame
+	int frame_width = 0, frame_height = 0;	// Zero if the image has no crop comment
+	int width = 0, height = 0;
+	std::vector<int> values;		// Three per pixel, row by row
+};
+
+static bool read_part(const std::string& path, part& p) {
+	std::ifstream in(path);
+	if (!in) return false;
+	p.path = path;
+
+	// Reads the header's tokens, taking the crop comment from among the others.
+	std::vector<int> header;
+	std::string magic;
+	if (!(in >> magic) || magic != "P3") return false;
+	while (header.size() < 3) {
+		in >> std::ws;
+		if (in.peek() == '#') {
+			std::string line, word;
+			std::getline(in, line);
+			std::istringstream comment(line);
+			comment >> word >> word;
+			if (word == "crop") comment >> p.x >> p.y >> word >> p.frame_width >> p.frame_height;
+			continue;
+		}
+		int value;
+		if (!(in >> value)) return false;
+		header.push_back(value);
+	}
+	p.width = header[0];
+	p.height = header[1];
+	if (p.width <= 0 || p.height <= 0) return false;
+
+	p.values.resize(size_t(p.width) * p.height * 3);
+	for (auto& v : p.values)
+		if (!(in >> v)) return false;
+	return true;
+}
+
+int main(int argc, char** argv) {
+	// Usage: merge_tiles out.ppm part.ppm [part.ppm ...]
+	if (argc < 3) {
+		std::cerr << "Usage: merge_tiles out.ppm part.ppm [part.ppm ...]\n";
+		return 2;
+	}
+
+	std::vector<part> parts;
+	int frame_width = 0, frame_height = 0;
+	for (int a = 2; a < argc; a++) {
+		part p;
+		if (!read_part(argv[a], p)) {
+			std::cerr << "ERROR: Could not read image '" << argv[a] << "'.\n";
+			return 2;
+		}
+		auto w = p.frame_width ? p.frame_width : p.width, h = p.frame_height ? p.frame_height : p.height;
+		if (frame_width && (w != frame_width || h != frame_height)) {
+			std::cerr << "ERROR: '" << p.path << "' is from a " << w << 'x' << h << " frame, not "
+					  << frame_width << 'x' << frame_height << ".\n";
+			return 2;
+		}
+		frame_width = w;
+		frame_height = h;
+		parts.push_back(std::move(p));
+	}
+
+	std::vector<int> frame(size_t(frame_width) * frame_height * 3, 0);
+	std::vector<int> coverage(size_t(frame_width) * frame_height, 0);
+	for (const auto& p : parts) {
+		for (int j = 0; j < p.height; j++) {
+			for (int i = 0; i < p.width; i++) {
+				int x = p.x + i, y = p.y + j;
+				if (x < 0 || y < 0 || x >= frame_width || y >= frame_height) continue;
+				auto to = size_t(y) * frame_width + x, from = size_t(j) * p.width + i;
+				for (int k = 0; k < 3; k++) frame[3 * to + k] = p.values[3 * from + k];
+				coverage[to]++;
+			}
+		}
+	}
+
+	std::ofstream out(argv[1]);
+	out << "P3\n" << frame_width << ' ' << frame_height << "\n255\n";
+	for (size_t n = 0; n < coverage.size(); n++)
+		out << frame[3 * n] << ' ' << frame[3 * n + 1] << ' ' << frame[3 * n + 2] << '\n';
+	if (!out) {
+		std::cerr << "ERROR: Could not write '" << argv[1] << "'.\n";
+		return 2;
+	}
+
+	size_t missing = 0, overlapping = 0;
+	for (auto c : coverage) {
+		if (c == 0) missing++;
+		if (c > 1) overlapping++;
+	}
+	std::clog << "Merged " << parts.size() << " images into " << frame_width << 'x' << frame_height
+			  << "; " << missing << " pixels missing, " << overlapping << " covered more than once\n";
+	return missing ? 1 : 0;
+}
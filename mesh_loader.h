@@ -0,0 +1,394 @@
+#ifndef MESH_LOADER_H
+#define MESH_LOADER_H
+
+#include "triangle_mesh.h"
+
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+// Streaming loaders for Wavefront OBJ and binary PLY files. Both read the file in fixed-size
+// chunks, so peak memory is the mesh itself plus one read buffer.
+
+class chunked_reader {
+public:
+	chunked_reader(const std::string& filename) : file(std::fopen(filename.c_str(), "rb")), buffer(1 << 20) {}
+	~chunked_reader() { if (file) std::fclose(file); }
+
+	bool is_open() const { return file != nullptr; }
+
+	bool read_line(std::string& line) {
+		// Reads the next line without its terminator. Returns false at end of file.
+		line.clear();
+		while (true) {
+			if (pos == end && !refill()) return !line.empty();
+			auto* start = buffer.data() + pos;
+			auto* newline = static_cast<const char*>(std::memchr(start, '\n', end - pos));
+			if (newline) {
+				line.append(start, size_t(newline - start));
+				pos += (newline - start) + 1;
+				return true;
+			}
+			line.append(start, end - pos);
+			pos = end;
+		}
+	}
+
+	template <typename F>
+	bool for_each_line(F&& visit) {
+		// Calls visit(begin, end) for every line, parsing straight out of the read buffer.
+		// Lines that straddle a chunk boundary are carried over to the next chunk.
+		while (true) {
+			if (pos == end && !refill()) return true;
+			const char* start = buffer.data() + pos;
+			const char* stop = buffer.data() + end;
+			while (start < stop) {
+				auto* newline = static_cast<const char*>(std::memchr(start, '\n', stop - start));
+				if (!newline) break;
+				visit(start, newline);
+				start = newline + 1;
+			}
+			pos = start - buffer.data();
+			if (pos < end) {
+				if (!refill()) {
+					visit(buffer.data() + pos, buffer.data() + end);
+					return true;
+				}
+			}
+		}
+	}
+
+	bool read_bytes(void* out, size_t count) {
+		auto* dst = static_cast<char*>(out);
+		while (count > 0) {
+			if (pos == end && !refill()) return false;
+			auto n = std::min(count, end - pos);
+			std::memcpy(dst, buffer.data() + pos, n);
+			pos += n;
+			dst += n;
+			count -= n;
+		}
+		return true;
+	}
+
+private:
+	std::FILE* file;
+	std::vector<char> buffer;
+	size_t pos = 0;
+	size_t end = 0;
+
+	bool refill() {
+		// Moves the unread tail to the front of the buffer and appends more file data.
+		if (!file) return false;
+		auto tail = end - pos;
+		std::memmove(buffer.data(), buffer.data() + pos, tail);
+		if (tail == buffer.size()) buffer.resize(2 * buffer.size());
+		auto n = std::fread(buffer.data() + tail, 1, buffer.size() - tail, file);
+		pos = 0;
+		end = tail + n;
+		return n > 0;
+	}
+};
+
+inline const char* skip_spaces(const char* p, const char* end) {
+	while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+	return p;
+}
+
+inline const char* parse_float(const char* p, const char* end, float& value) {
+	p = skip_spaces(p, end);
+	if (p < end && *p == '+') p++;
+	auto result = std::from_chars(p, end, value);
+	if (result.ec != std::errc()) value = 0;
+	return result.ptr;
+}
+
+inline const char* parse_int(const char* p, const char* end, long long& value) {
+	if (p < end && *p == '+') p++;
+	auto result = std::from_chars(p, end, value);
+	if (result.ec != std::errc()) value = 0;
+	return result.ptr;
+}
+
+inline bool load_obj(const std::string& filename, mesh_data& mesh) {
+	// Loads positions, normals, texture coordinates and faces. Polygons are triangulated as
+	// fans, negative (relative) indices are resolved, and all other statements are ignored.
+	chunked_reader reader(filename);
+	if (!reader.is_open()) return false;
+
+	bool missing_normals = false;
+	bool missing_uvs = false;
+	long long corner[3][3];	// First, previous and current corner as (position, uv, normal)
+
+	reader.for_each_line([&](const char* p, const char* end) {
+		p = skip_spaces(p, end);
+		if (end - p < 2) return;
+
+		if (p[0] == 'v') {
+			float x, y, z;
+			if (p[1] == ' ' || p[1] == '\t') {
+				p = parse_float(parse_float(parse_float(p + 1, end, x), end, y), end, z);
+				mesh.positions.insert(mesh.positions.end(), { x, y, z });
+			}
+			else if (p[1] == 'n') {
+				p = parse_float(parse_float(parse_float(p + 2, end, x), end, y), end, z);
+				mesh.normals.insert(mesh.normals.end(), { x, y, z });
+			}
+			else if (p[1] == 't') {
+				p = parse_float(parse_float(p + 2, end, x), end, y);
+				mesh.uvs.insert(mesh.uvs.end(), { x, y });
+			}
+		}
+		else if (p[0] == 'f' && (p[1] == ' ' || p[1] == '\t')) {
+			long long counts[3] = {
+				(long long)(mesh.positions.size() / 3), (long long)(mesh.uvs.size() / 2), (long long)(mesh.normals.size() / 3)
+			};
+			int corner_count = 0;
+			p += 1;
+			while (true) {
+				p = skip_spaces(p, end);
+				if (p >= end) break;
+
+				auto& c = corner[corner_count < 2 ? corner_count : 2];
+				c[0] = c[1] = c[2] = -1;
+				for (int attr = 0; attr < 3; attr++) {
+					if (attr > 0) {
+						if (p >= end || *p != '/') break;
+						p++;
+					}
+					long long index = 0;
+					if (p < end && *p != '/' && *p != ' ')
+						p = parse_int(p, end, index);
+					c[attr] = index < 0 ? counts[attr] + index : index - 1;
+				}
+				while (p < end && *p != ' ' && *p != '\t' && *p != '\r') p++;
+
+				if (++corner_count >= 3) {
+					for (int k = 0; k < 3; k++) {
+						mesh.indices.push_back(uint32_t(corner[k][0]));
+						missing_uvs |= corner[k][1] < 0;
+						missing_normals |= corner[k][2] < 0;
+						mesh.uv_indices.push_back(uint32_t(corner[k][1] < 0 ? 0 : corner[k][1]));
+						mesh.normal_indices.push_back(uint32_t(corner[k][2] < 0 ? 0 : corner[k][2]));
+					}
+					// Fan triangulation: the current corner becomes the previous one.
+					std::memcpy(corner[1], corner[2], sizeof(corner[1]));
+				}
+			}
+		}
+	});
+
+	if (missing_uvs || mesh.uvs.empty()) {
+		mesh.uvs.clear();
+		mesh.uv_indices.clear();
+	}
+	if (missing_normals || mesh.normals.empty()) {
+		mesh.normals.clear();
+		mesh.normal_indices.clear();
+	}
+	// Drop per-attribute index buffers that duplicate the position indices.
+	if (mesh.uv_indices == mesh.indices) mesh.uv_indices.clear();
+	if (mesh.normal_indices == mesh.indices) mesh.normal_indices.clear();
+
+	// Every corner must name an existing position, uv and normal; empty attribute index
+	// buffers reuse the position indices.
+	auto in_range = [](const std::vector<uint32_t>& indices, size_t count) {
+		for (auto index : indices)
+			if (index >= count) return false;
+		return true;
+	};
+	const auto& uv_indices = mesh.uv_indices.empty() ? mesh.indices : mesh.uv_indices;
+	const auto& normal_indices = mesh.normal_indices.empty() ? mesh.indices : mesh.normal_indices;
+	if (!in_range(mesh.indices, mesh.positions.size() / 3)
+		|| (!mesh.uvs.empty() && !in_range(uv_indices, mesh.uvs.size() / 2))
+		|| (!mesh.normals.empty() && !in_range(normal_indices, mesh.normals.size() / 3))) {
+		std::cerr << "ERROR: Face index out of range in '" << filename << "'.\n";
+		mesh = mesh_data();
+		return false;
+	}
+	mesh.uv_indices.shrink_to_fit();
+	mesh.normal_indices.shrink_to_fit();
+	return true;
+}
+
+inline bool load_ply(const std::string& filename, mesh_data& mesh) {
+	// Loads the vertex (x, y, z, optional nx/ny/nz and u/v) and face elements of a binary
+	// little- or big-endian PLY file.
+	chunked_reader reader(filename);
+	if (!reader.is_open()) return false;
+
+	struct property {
+		std::string name;
+		int size = 0;			// Byte size of the scalar, or of the list elements
+		char kind = 'f';		// 'f' floating point, 'i' signed, 'u' unsigned
+		int count_size = 0;		// Byte size of the list length, 0 for scalars
+	};
+	struct element {
+		std::string name;
+		size_t count = 0;
+		std::vector<property> properties;
+	};
+
+	auto parse_type = [](const std::string& type, int& size, char& kind) {
+		if (type == "char" || type == "int8") { size = 1; kind = 'i'; }
+		else if (type == "uchar" || type == "uint8") { size = 1; kind = 'u'; }
+		else if (type == "short" || type == "int16") { size = 2; kind = 'i'; }
+		else if (type == "ushort" || type == "uint16") { size = 2; kind = 'u'; }
+		else if (type == "int" || type == "int32") { size = 4; kind = 'i'; }
+		else if (type == "uint" || type == "uint32") { size = 4; kind = 'u'; }
+		else if (type == "float" || type == "float32") { size = 4; kind = 'f'; }
+		else if (type == "double" || type == "float64") { size = 8; kind = 'f'; }
+		else return false;
+		return true;
+	};
+
+	std::string line;
+	std::vector<element> elements;
+	bool big_endian = false;
+	if (!reader.read_line(line) || line.compare(0, 3, "ply") != 0) return false;
+	while (reader.read_line(line)) {
+		if (!line.empty() && line.back() == '\r') line.pop_back();
+		char a[64] = {}, b[64] = {}, c[64] = {}, d[64] = {};
+		int n = std::sscanf(line.c_str(), "%63s %63s %63s %63s", a, b, c, d);
+		std::string keyword = a;
+		if (keyword == "end_header") break;
+		if (keyword == "format") {
+			if (std::string(b) == "binary_big_endian") big_endian = true;
+			else if (std::string(b) != "binary_little_endian") {
+				std::cerr << "ERROR: Only binary PLY files are supported ('" << filename << "').\n";
+				return false;
+			}
+		}
+		else if (keyword == "element" && n >= 3) {
+			elements.push_back({ b, size_t(std::strtoull(c, nullptr, 10)), {} });
+		}
+		else if (keyword == "property" && !elements.empty()) {
+			property prop;
+			char count_kind;
+			bool ok = (std::string(b) == "list" && n >= 4)
+				? parse_type(c, prop.count_size, count_kind) && parse_type(d, prop.size, prop.kind)
+				: parse_type(b, prop.size, prop.kind);
+			if (!ok) return false;
+			line.erase(line.find_last_not_of(" \t") + 1);
+			prop.name = line.substr(line.find_last_of(" \t") + 1);
+			elements.back().properties.push_back(prop);
+		}
+	}
+
+	const uint16_t endian_probe = 1;
+	bool swap = big_endian == (*reinterpret_cast<const unsigned char*>(&endian_probe) == 1);
+
+	auto read_value = [&](int size, char kind, double& value) {
+		unsigned char raw[8];
+		if (!reader.read_bytes(raw, size)) return false;
+		if (swap) std::reverse(raw, raw + size);
+		switch (size * 4 + (kind == 'f' ? 0 : kind == 'i' ? 1 : 2)) {
+			case 4 + 1: value = *reinterpret_cast<int8_t*>(raw); break;
+			case 4 + 2: value = *reinterpret_cast<uint8_t*>(raw); break;
+			case 8 + 1: { int16_t x; std::memcpy(&x, raw, 2); value = x; break; }
+			case 8 + 2: { uint16_t x; std::memcpy(&x, raw, 2); value = x; break; }
+			case 16 + 0: { float x; std::memcpy(&x, raw, 4); value = x; break; }
+			case 16 + 1: { int32_t x; std::memcpy(&x, raw, 4); value = x; break; }
+			case 16 + 2: { uint32_t x; std::memcpy(&x, raw, 4); value = x; break; }
+			case 32 + 0: { double x; std::memcpy(&x, raw, 8); value = x; break; }
+			default: return false;
+		}
+		return true;
+	};
+
+	for (const auto& elem : elements) {
+		bool is_vertex = elem.name == "vertex";
+		bool is_face = elem.name == "face";
+
+		// Map vertex properties to output slots: 0-2 position, 3-5 normal, 6-7 uv.
+		std::vector<int> slot(elem.properties.size(), -1);
+		bool has_normal = false, has_uv = false;
+		for (size_t i = 0; i < elem.properties.size() && is_vertex; i++) {
+			static const char* names[][3] = {
+				{ "x" }, { "y" }, { "z" }, { "nx" }, { "ny" }, { "nz" },
+				{ "u", "s", "texture_u" }, { "v", "t", "texture_v" }
+			};
+			for (int s = 0; s < 8 && slot[i] < 0; s++) {
+				for (auto* name : names[s])
+					if (name && elem.properties[i].name == name) slot[i] = s;
+			}
+			has_normal |= slot[i] >= 3 && slot[i] <= 5;
+			has_uv |= slot[i] >= 6;
+		}
+		if (is_vertex) {
+			mesh.positions.reserve(3 * elem.count);
+			if (has_normal) mesh.normals.reserve(3 * elem.count);
+			if (has_uv) mesh.uvs.reserve(2 * elem.count);
+		}
+		if (is_face) mesh.indices.reserve(3 * elem.count);
+
+		for (size_t e = 0; e < elem.count; e++) {
+			double values[8] = {};
+			for (size_t i = 0; i < elem.properties.size(); i++) {
+				const auto& prop = elem.properties[i];
+				double value;
+				if (prop.count_size == 0) {
+					if (!read_value(prop.size, prop.kind, value)) return false;
+					if (slot[i] >= 0) values[slot[i]] = value;
+					continue;
+				}
+
+				double length;
+				if (!read_value(prop.count_size, 'u', length)) return false;
+				bool is_indices = is_face && (prop.name == "vertex_indices" || prop.name == "vertex_index");
+				uint32_t first = 0, previous = 0;
+				for (int k = 0; k < int(length); k++) {
+					if (!read_value(prop.size, prop.kind, value)) return false;
+					if (!is_indices) continue;
+					auto index = uint32_t(value);
+					if (k == 0) first = index;
+					else if (k >= 2) mesh.indices.insert(mesh.indices.end(), { first, previous, index });
+					previous = index;
+				}
+			}
+			if (is_vertex) {
+				mesh.positions.insert(mesh.positions.end(), { float(values[0]), float(values[1]), float(values[2]) });
+				if (has_normal) mesh.normals.insert(mesh.normals.end(), { float(values[3]), float(values[4]), float(values[5]) });
+				if (has_uv) mesh.uvs.insert(mesh.uvs.end(), { float(values[6]), float(values[7]) });
+			}
+		}
+	}
+
+	auto vertex_count = mesh.positions.size() / 3;
+	for (auto index : mesh.indices) {
+		if (index >= vertex_count) {
+			std::cerr << "ERROR: Face index out of range in '" << filename << "'.\n";
+			mesh = mesh_data();
+			return false;
+		}
+	}
+	return true;
+}
+
+inline shared_ptr<triangle_mesh> load_mesh(const std::string& filename, shared_ptr<material> mat) {
+	// Loads an .obj or .ply file into a triangle_mesh and reports load time, BVH build time
+	// and memory per triangle. On failure an empty mesh is returned.
+	auto start = std::chrono::steady_clock::now();
+
+	mesh_data data;
+	auto extension = filename.substr(filename.find_last_of('.') + 1);
+	for (auto& ch : extension) ch = char(std::tolower(ch));
+	bool loaded = extension == "ply" ? load_ply(filename, data) : load_obj(filename, data);
+	if (!loaded) std::cerr << "ERROR: Could not load mesh file '" << filename << "'.\n";
+
+	auto parsed = std::chrono::steady_clock::now();
+	auto mesh = make_shared<triangle_mesh>(std::move(data), mat);
+	auto built = std::chrono::steady_clock::now();
+
+	auto triangles = mesh->triangle_count();
+	std::clog << "Mesh '" << filename << "': " << triangles << " triangles, load "
+			  << std::chrono::duration<double>(parsed - start).count() << "s, BVH "
+			  << std::chrono::duration<double>(built - parsed).count() << "s, "
+			  << (triangles ? mesh->memory_usage() / double(triangles) : 0.0) << " bytes/triangle\n";
+	return mesh;
+}
+
+#endif // !MESH_LOADER_H
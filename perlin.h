@@ -1,11 +1,21 @@
 #ifndef PERLIN_H
 #define PERLIN_H
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
 class perlin {
 public:
 	perlin() {
 		for (int i = 0; i < point_count; i++) {
-			randvec[i] = unit_vector(vec3::random(-1, 1));
+			auto g = unit_vector(vec3::random(-1, 1));
+			randvec_x[i] = float(g.x());
+			randvec_y[i] = float(g.y());
+			randvec_z[i] = float(g.z());
 		}
 		perlin_generate_perm(perm_x);
 		perlin_generate_perm(perm_y);
@@ -13,6 +23,7 @@ public:
 	}
 
 	double noise(const point3& p) const {
+		// Exact noise at a single point, in double precision.
 		auto u = p.x() - std::floor(p.x());
 		auto v = p.y() - std::floor(p.y());
 		auto w = p.z() - std::floor(p.z());
@@ -25,36 +36,99 @@ public:
 		for (int di = 0; di < 2; di++) {
 			for (int dj = 0; dj < 2; dj++) {
 				for (int dk = 0; dk < 2; dk++) {
-					c[di][dj][dk] = randvec[
-							perm_x[(i + di) & 255] ^
-							perm_y[(j + dj) & 255] ^
-							perm_z[(k + dk) & 255]];
+					auto g = gradient(i + di, j + dj, k + dk);
+					c[di][dj][dk] = vec3(randvec_x[g], randvec_y[g], randvec_z[g]);
 				}
 			}
 		}
 		return perlin_interp(c, u, v, w);
 	}
 
-	double turb(const point3& p, int depth) const{
+	double turb(const point3& p, int depth) const {
+		// Sum of `depth` octaves of noise, each at twice the frequency and half the weight of
+		// the one before. Up to `lanes` octaves are evaluated together in single precision.
 		auto accum = 0.0;
-		auto temp_p = p;
-		auto weight = 1.0;
-		
-		for (int i = 0; i < depth; i++) {
-			accum += weight * noise(temp_p);
-			weight *= 0.5;
-			temp_p *= 2;
+		for (int first = 0; first < depth; first += lanes) {
+			float octaves[lanes];
+			noise_octaves(p, first, octaves);
+			auto count = std::min(lanes, depth - first);
+			auto weight = std::ldexp(1.0, -first);
+			for (int k = 0; k < count; k++, weight *= 0.5)
+				accum += weight * octaves[k];
 		}
 		return std::fabs(accum);
 	}
 
 private:
 	static const int point_count = 256;
-	vec3 randvec[point_count];
+	static const int lanes = 8;
+	float randvec_x[point_count];
+	float randvec_y[point_count];
+	float randvec_z[point_count];
 	int perm_x[point_count];
 	int perm_y[point_count];
 	int perm_z[point_count];
 
+	int gradient(int i, int j, int k) const {
+		return perm_x[i & 255] ^ perm_y[j & 255] ^ perm_z[k & 255];
+	}
+
+	void noise_octaves(const point3& p, int first, float* out) const {
+		// Noise at p * 2^(first + k) for each lane k. The lattice cells are found in double
+		// precision (scaling by a power of two is exact); only the interpolation is in float,
+		// written so that the lane loops vectorize.
+		float u[lanes], v[lanes], w[lanes];
+		int px[2][lanes], py[2][lanes], pz[2][lanes];	// Permutations of the cell's two x, y, z
+		auto scale = std::ldexp(1.0, first);
+		for (int l = 0; l < lanes; l++, scale *= 2) {
+			int64_t cell[3];
+			float* fraction[3] = { u, v, w };
+			for (int a = 0; a < 3; a++) {
+				// floor() without a library call; the lattice repeats every 256 cells, so the
+				// cell is wrapped to keep high octaves in range.
+				auto x = p[a] * scale;
+				auto c = int64_t(x);
+				c -= x < double(c);
+				cell[a] = c & 255;
+				fraction[a][l] = float(x - double(c));
+			}
+			for (int d = 0; d < 2; d++) {
+				px[d][l] = perm_x[(cell[0] + d) & 255];
+				py[d][l] = perm_y[(cell[1] + d) & 255];
+				pz[d][l] = perm_z[(cell[2] + d) & 255];
+			}
+		}
+
+		float uu[lanes], vv[lanes], ww[lanes];
+		#pragma omp simd
+		for (int l = 0; l < lanes; l++) {
+			uu[l] = u[l] * u[l] * (3 - 2 * u[l]);
+			vv[l] = v[l] * v[l] * (3 - 2 * v[l]);
+			ww[l] = w[l] * w[l] * (3 - 2 * w[l]);
+			out[l] = 0;
+		}
+
+		for (int corner = 0; corner < 8; corner++) {
+			int di = corner >> 2, dj = (corner >> 1) & 1, dk = corner & 1;
+			float gx[lanes], gy[lanes], gz[lanes];
+			for (int l = 0; l < lanes; l++) {
+				auto g = px[di][l] ^ py[dj][l] ^ pz[dk][l];
+				gx[l] = randvec_x[g];
+				gy[l] = randvec_y[g];
+				gz[l] = randvec_z[g];
+			}
+
+			#pragma omp simd
+			for (int l = 0; l < lanes; l++) {
+				float dot = gx[l] * (u[l] - di) + gy[l] * (v[l] - dj) + gz[l] * (w[l] - dk);
+				float wx = di ? uu[l] : 1 - uu[l];
+				float wy = dj ? vv[l] : 1 - vv[l];
+				float wz = dk ? ww[l] : 1 - ww[l];
+				out[l] += dot * wx * wy * wz;
+			}
+		}
+	}
+
 	static void perlin_generate_perm(int* p) {
 		for (int i = 0; i < point_count; i++) {
 			p[i] = i;
@@ -91,4 +165,70 @@ private:
 	}
 };
 
+class turbulence_volume {
+public:
+	// perlin::turb sampled on a grid over a box and trilinearly interpolated, for when exact
+	// noise is not required. `resolution` is the number of cells along the longest side of
+	// the box; cells are cubes. Points outside the box are not covered.
+	turbulence_volume(const perlin& noise, int depth, const point3& min, const point3& max, int resolution)
+		: min(min)
+	{
+		auto start = std::chrono::steady_clock::now();
+		auto size = max - min;
+		auto longest = std::fmax(size.x(), std::fmax(size.y(), size.z()));
+		resolution = std::max(resolution, 1);
+		cell = longest > 0 ? longest / resolution : 1;
+		inv_cell = 1 / cell;
+		for (int a = 0; a < 3; a++)
+			samples[a] = std::max(2, int(std::ceil(size[a] * inv_cell)) + 1);
+
+		values.resize(size_t(samples[0]) * samples[1] * samples[2]);
+		#pragma omp parallel for schedule(dynamic)
+		for (int z = 0; z < samples[2]; z++)
+			for (int y = 0; y < samples[1]; y++)
+				for (int x = 0; x < samples[0]; x++)
+					values[index(x, y, z)] = float(noise.turb(min + cell * vec3(x, y, z), depth));
+
+		auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+		std::clog << "Baked turbulence: " << samples[0] << 'x' << samples[1] << 'x' << samples[2]
+				  << " samples in " << elapsed.count() << " ms, " << memory_usage() / 1024 << " KB\n";
+	}
+
+	bool contains(const point3& p) const {
+		for (int a = 0; a < 3; a++) {
+			auto s = (p[a] - min[a]) * inv_cell;
+			if (!(s >= 0 && s <= samples[a] - 1)) return false;
+		}
+		return true;
+	}
+
+	double value(const point3& p) const {
+		// Interpolated turbulence at a point inside the box.
+		int c[3];
+		double f[3];
+		for (int a = 0; a < 3; a++) {
+			auto s = (p[a] - min[a]) * inv_cell;
+			c[a] = std::clamp(int(s), 0, samples[a] - 2);
+			f[a] = s - c[a];
+		}
+		auto lerp = [](double a, double b, double t) { return a + t * (b - a); };
+		auto at = [&](int dx, int dy, int dz) { return values[index(c[0] + dx, c[1] + dy, c[2] + dz)]; };
+		return lerp(lerp(lerp(at(0, 0, 0), at(1, 0, 0), f[0]), lerp(at(0, 1, 0), at(1, 1, 0), f[0]), f[1]),
+					lerp(lerp(at(0, 0, 1), at(1, 0, 1), f[0]), lerp(at(0, 1, 1), at(1, 1, 1), f[0]), f[1]),
+					f[2]);
+	}
+
+	size_t memory_usage() const { return values.capacity() * sizeof(float); }
+
+private:
+	point3 min;
+	double cell, inv_cell;
+	int samples[3];
+	std::vector<float> values;
+
+	size_t index(int x, int y, int z) const {
+		return (size_t(z) * samples[1] + y) * samples[0] + x;
+	}
+};
+
 #endif // !PERLIN_H
@@ -0,0 +1,64 @@
+#ifndef PREVIEW_H
+#define PREVIEW_H
+
+#include "color.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+class preview_writer {
+public:
+	// Writes snapshots of a render in progress to one PPM file, at most once per interval. Each
+	// is written on a thread of its own, so rendering goes on meanwhile, and under a temporary
+	// name that is then renamed, so a viewer never reads a partial file.
+	preview_writer(const std::string& path, double interval_seconds)
+		: path(path), interval(interval_seconds), last(std::chrono::steady_clock::now()) {}
+
+	~preview_writer() {
+		if (writer.joinable()) writer.join();
+	}
+
+	preview_writer(const preview_writer&) = delete;
+	preview_writer& operator=(const preview_writer&) = delete;
+
+	bool due() const {
+		// True if the interval has passed and the previous snapshot is written.
+		return !busy && std::chrono::duration<double>(std::chrono::steady_clock::now() - last).count() >= interval;
+	}
+
+	void write(int width, std::vector<color> pixels) {
+		// Takes linear colors, row by row.
+		if (writer.joinable()) writer.join();
+		last = std::chrono::steady_clock::now();
+		busy = true;
+		writer = std::thread([this, width, pixels = std::move(pixels)]() {
+			auto temporary = path + ".tmp";
+			{
+				std::ofstream out(temporary);
+				out << "P3\n" << width << ' ' << pixels.size() / width << "\n255\n";
+				for (const auto& p : pixels) write_color(out, p);
+				if (!out) std::cerr << "ERROR: Could not write preview '" << temporary << "'.\n";
+			}
+			// POSIX rename replaces the old file in one step; elsewhere it has to go first.
+			if (std::rename(temporary.c_str(), path.c_str()) != 0
+				&& (std::remove(path.c_str()), std::rename(temporary.c_str(), path.c_str()) != 0))
+				std::cerr << "ERROR: Could not rename preview to '" << path << "'.\n";
+			busy = false;
+		});
+	}
+
+private:
+	std::string path;
+	double interval;
+	std::chrono::steady_clock::time_point last;
+	std::atomic<bool> busy{false};
+	std::thread writer;
+};
+
+#endif // !PREVIEW_H
@@ -25,6 +25,7 @@ public:
 	aabb bounding_box() const override { return bbox; }
 
 	bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+		RT_STAT(STAT_QUAD_TESTS);
 		auto ndotd = dot(normal, r.direction());
 
 		// No hit if the ray is parallel to the plane.
@@ -45,7 +46,9 @@ public:
 		
 		rec.t = t;
 		rec.p = I;
-		rec.mat = mat;
+		rec.dpdu = u;
+		rec.dpdv = v;
+		rec.mat = mat.get();
 		rec.set_face_normal(r, normal);
 
 		return true; 
@@ -60,6 +63,7 @@ public:
 	}
 
 	double pdf_value(const point3& origin, const vec3& direction) const override {
+		RT_STAT(STAT_SHADOW_RAYS);
 		hit_record rec;
 		if (!this->hit(ray(origin, direction), interval(0.001, infinity), rec))
 			return 0;
@@ -75,6 +79,8 @@ public:
 		return p - origin;
 	}
 
+	friend class compiled_scene;
+	friend class scene;
 private:
 	point3 Q;
 	vec3 u, v;
@@ -86,28 +92,4 @@ private:
 	double area;
 };
 
-inline shared_ptr<hittable_list> box(const point3& a, const point3& b, shared_ptr<material> mat)
-{
-	// Returns the 3D box (six sides) that contains the two opposite vertices a & b.
-
-	auto sides = make_shared<hittable_list>();
-
-	// Construct the two opposite vertices with the minimum and maximum coordinates.
-	auto min = point3(std::fmin(a.x(), b.x()), std::fmin(a.y(), b.y()), std::fmin(a.z(), b.z()));
-	auto max = point3(std::fmax(a.x(), b.x()), std::fmax(a.y(), b.y()), std::fmax(a.z(), b.z()));
-
-	auto dx = vec3(max.x() - min.x(), 0, 0);
-	auto dy = vec3(0, max.y() - min.y(), 0);
-	auto dz = vec3(0, 0, max.z() - min.z());
-
-	sides->add(make_shared<quad>(point3(min.x(), min.y(), max.z()), dx, dy, mat)); // front
-	sides->add(make_shared<quad>(point3(max.x(), min.y(), max.z()), -dz, dy, mat)); // right
-	sides->add(make_shared<quad>(point3(max.x(), min.y(), min.z()), -dx, dy, mat)); // back
-	sides->add(make_shared<quad>(point3(min.x(), min.y(), min.z()), dz, dy, mat)); // left
-	sides->add(make_shared<quad>(point3(min.x(), max.y(), max.z()), dx, -dz, mat)); // top
-	sides->add(make_shared<quad>(point3(min.x(), min.y(), min.z()), dx, dz, mat)); // bottom
-
-	return sides;
-}
-
 #endif // !QUAD_H
@@ -9,15 +9,34 @@ public:
 
 	ray(const vec3& origin, const vec3& direction) : orig(origin), dir(direction) {}
 
+	// A ray carrying a cone: `width` is the cone's width at the origin and `spread` how much
+	// the width grows per unit of distance travelled. Texture lookups use the width at the hit
+	// point as their filter footprint; rays without a cone have a footprint of zero.
+	ray(const vec3& origin, const vec3& direction, double width, double spread)
+		: orig(origin), dir(direction), width(width), spread(spread) {}
+
 	const point3& origin() const { return orig; }
 	const vec3& direction() const { return dir; }
+	double cone_spread() const { return spread; }
 
 	point3 at(double t) const {
 		return orig + t * dir;
 	}
+
+	double cone_width(double t) const {
+		// Width of the ray's cone at parameter t.
+		if (spread == 0) return width;
+		return width + spread * t * dir.length();
+	}
 private:
 	point3 orig;
 	vec3 dir;
+	double width = 0;
+	double spread = 0;
 };
 
+// Rays the calling thread has intersected with a scene, counted by the integrators for
+// camera::render's throughput report.
+inline thread_local size_t rays_traced = 0;
+
 #endif
@@ -0,0 +1,197 @@
+// Render benchmark: renders scenes headless over a sweep of thread counts and reports the
+// time of each phase (scene build, BVH build, render, output), ray and sample throughput and
+// parallel efficiency, optionally as JSON. Built with RT_ENABLE_STATS, the JSON also holds each
+// run's hot-path counters.
+
+#include "rtweekend.h"
+
+#include "scenes.h"
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <omp.h>
+
+struct bench_run {
+	std::string scene;
+	int width, samples_per_pixel;
+	double scene_seconds;		// Building the scene description
+	render_stats stats;
+	stat_block counters;		// Empty unless built with RT_ENABLE_STATS
+	double speedup = 1, efficiency = 1;	// Against the scene's run with the fewest threads
+};
+
+static std::vector<std::string> split(const std::string& list) {
+	std::vector<std::string> items;
+	std::stringstream in(list);
+	for (std::string item; std::getline(in, item, ',');)
+		if (!item.empty()) items.push_back(item);
+	return items;
+}
+
+static void write_json(std::ostream& out, unsigned seed, const std::vector<bench_run>& runs) {
+	out << "{\n  \"seed\": " << seed << ",\n  \"hardware_threads\": " << omp_get_num_procs() << ",\n  \"runs\": [\n";
+	for (size_t i = 0; i < runs.size(); i++) {
+		const auto& r = runs[i];
+		const auto& s = r.stats;
+		out << "    { \"scene\": \"" << r.scene << "\", \"threads\": " << s.threads
+			<< ", \"image_width\": " << r.width << ", \"samples_per_pixel\": " << r.samples_per_pixel
+			<< ",\n      \"scene_build_seconds\": " << r.scene_seconds << ", \"bvh_build_seconds\": " << s.build_seconds
+			<< ", \"render_seconds\": " << s.render_seconds << ", \"denoise_seconds\": " << s.denoise_seconds << ", \"output_seconds\": " << s.output_seconds
+			<< ",\n      \"samples\": " << s.samples << ", \"primary_rays\": " << s.primary_rays
+			<< ", \"secondary_rays\": " << s.secondary_rays << ", \"noise\": " << s.noise
+			<< ", \"relative_noise\": " << s.relative_noise
+			<< ",\n      \"samples_per_second\": " << s.samples / s.render_seconds
+			<< ", \"primary_rays_per_second\": " << s.primary_rays / s.render_seconds
+			<< ", \"secondary_rays_per_second\": " << s.secondary_rays / s.render_seconds
+			<< ",\n      \"speedup\": " << r.speedup << ", \"parallel_efficiency\": " << r.efficiency;
+#ifdef RT_ENABLE_STATS
+		out << ",\n      \"counters\": ";
+		stat_registry::write_json(r.counters, out);
+#endif
+		out << " }" << (i + 1 < runs.size() ? "," : "") << '\n';
+	}
+	out << "  ]\n}\n";
+}
+
+int main(int argc, char** argv) {
+	// Usage: render_bench [--scenes a,b,...] [--threads 1,2,...] [--width pixels] [--spp samples]
+	//                     [--seed n] [--json out.json] [--heatmaps prefix] [--trace out.json]
+	//                     [--progressive single|doubling] [--preview path] [--budget seconds]
+	//                     [--stream rows] [--denoise] [--probe] [--verbose] [--list]
+	// By default every scene of the catalog renders at its own size, with 1, 2, 4, ... threads
+	// up to the number of cores. The renderer's own log is silenced unless --verbose is given.
+	// --heatmaps writes each run's cost heatmaps as <prefix>_<scene>_<threads>t_time.ppm, etc.
+	// --trace writes a Chrome trace of all runs, each under an event naming scene and threads.
+	// --progressive renders in passes over the whole frame; --preview writes their images.
+	// --budget renders each run in a time budget, with the samples per pixel as an upper bound.
+	// --stream writes the image in bands of rows as they are done, without a full frame buffer.
+	// --denoise filters each image at the end of its render.
+	// --probe logs the ray cost before and after compiling each scene; it is not timed.
+	std::vector<std::string> scene_names;
+	std::vector<int> thread_counts;
+	int width = 0, spp = 0;
+	unsigned seed = 1;
+	std::string json_path, heatmap_prefix, trace_path, preview_path;
+	auto progressive = PROGRESSIVE_OFF;
+	double budget = 0;
+	int stream_rows = 0;
+	bool verbose = false, denoise = false, probe = false;
+
+	for (int i = 1; i < argc; i++) {
+		auto arg = std::string(argv[i]);
+		if (arg == "--verbose") { verbose = true; continue; }
+		if (arg == "--denoise") { denoise = true; continue; }
+		if (arg == "--probe") { probe = true; continue; }
+		if (arg == "--list") {
+			for (const auto& entry : scene_catalog()) std::cout << entry.name << '\n';
+			return 0;
+		}
+		if (i + 1 >= argc) {
+			std::cerr << "ERROR: Missing value for '" << arg << "'.\n";
+			return 2;
+		}
+		auto value = std::string(argv[++i]);
+		if (arg == "--scenes") scene_names = split(value);
+		else if (arg == "--threads") for (const auto& t : split(value)) thread_counts.push_back(std::max(1, std::stoi(t)));
+		else if (arg == "--width") width = std::stoi(value);
+		else if (arg == "--spp") spp = std::stoi(value);
+		else if (arg == "--seed") seed = unsigned(std::stoul(value));
+		else if (arg == "--json") json_path = value;
+		else if (arg == "--heatmaps") heatmap_prefix = value;
+		else if (arg == "--trace") trace_path = value;
+		else if (arg == "--preview") preview_path = value;
+		else if (arg == "--budget") budget = std::stod(value);
+		else if (arg == "--stream") stream_rows = std::stoi(value);
+		else if (arg == "--progressive" && value == "single") progressive = PROGRESSIVE_SINGLE;
+		else if (arg == "--progressive" && value == "doubling") progressive = PROGRESSIVE_DOUBLING;
+		else {
+			std::cerr << "ERROR: Unknown option '" << arg << "'.\n";
+			return 2;
+		}
+	}
+
+	if (scene_names.empty())
+		for (const auto& entry : scene_catalog()) scene_names.push_back(entry.name);
+	if (thread_counts.empty()) {
+		int cores = omp_get_num_procs();
+		for (int t = 1; t < cores; t *= 2) thread_counts.push_back(t);
+		thread_counts.push_back(cores);
+	}
+
+	auto log_buffer = std::clog.rdbuf();
+	if (!verbose) std::clog.rdbuf(nullptr);
+	if (!trace_path.empty()) tracer::start();
+
+	std::vector<bench_run> runs;
+	std::cout << "scene                  threads  scene s    bvh s  render s  output s  Mrays/s  Msamples/s  efficiency\n";
+	for (const auto& name : scene_names) {
+		auto entry = find_scene(name);
+		if (!entry) {
+			std::cerr << "ERROR: Unknown scene '" << name << "'; --list shows them.\n";
+			continue;
+		}
+
+		size_t first = runs.size();
+		for (auto threads : thread_counts) {
+			// Every run builds the scene from the same seed, so each renders the same scene.
+			omp_set_num_threads(threads);
+			std::srand(seed);
+			trace_scope run_scope(entry->name, "run", "threads", threads);
+			auto start = std::chrono::steady_clock::now();
+			scene_setup s;
+			{
+				trace_scope scope("build scene", "scene");
+				entry->build(s);
+			}
+			auto scene_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+			if (width > 0) s.cam.image_width = width;
+			if (spp > 0) s.cam.samples_per_pixel = spp;
+			std::ostringstream image;	// Formatted as for a file, but kept in memory
+			s.cam.output = &image;
+			s.cam.progressive = progressive;
+			s.cam.preview_path = preview_path;
+			s.cam.time_budget = budget;
+			s.cam.stream_rows = stream_rows;
+			s.cam.denoise = denoise;
+			s.cam.probe_compile = probe;
+			if (!heatmap_prefix.empty())
+				s.cam.heatmap_prefix = heatmap_prefix + "_" + name + "_" + std::to_string(threads) + "t";
+			s.cam.render(s.world, s.lights);
+			if (s.after_render) s.after_render();
+
+			bench_run run{ name, s.cam.image_width, s.cam.stats.samples_per_pixel, scene_seconds, s.cam.stats,
+						   stat_registry::totals() };
+			const auto& base = runs.size() > first ? runs[first] : run;
+			run.speedup = base.stats.render_seconds / run.stats.render_seconds;
+			run.efficiency = run.speedup * base.stats.threads / run.stats.threads;
+			runs.push_back(run);
+
+			const auto& st = run.stats;
+			char line[160];
+			std::snprintf(line, sizeof line, "%-22s %7d %8.3f %8.3f %9.3f %9.3f %8.2f %11.3f %11.2f\n",
+						  name.c_str(), st.threads, run.scene_seconds, st.build_seconds, st.render_seconds,
+						  st.output_seconds, (st.primary_rays + st.secondary_rays) / st.render_seconds / 1e6,
+						  st.samples / st.render_seconds / 1e6, run.efficiency);
+			std::cout << line << std::flush;
+		}
+	}
+
+	std::clog.rdbuf(log_buffer);
+	if (!trace_path.empty()) {
+		tracer::stop();
+		if (!tracer::write(trace_path)) return 2;
+	}
+	if (!json_path.empty()) {
+		std::ofstream out(json_path);
+		write_json(out, seed, runs);
+		if (!out) {
+			std::cerr << "ERROR: Could not write '" << json_path << "'.\n";
+			return 2;
+		}
+	}
+}
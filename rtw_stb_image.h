@@ -10,81 +10,235 @@
 #define STBI_FAILURE_USERMSG
 #include "stb_image.h"
 
+#include "color.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <vector>
+
+// Storage format of image texels. srgb8 keeps 8-bit sRGB-encoded values (3 bytes per texel)
+// and decodes them through a table; half and float32 keep linear values for HDR images.
+enum class texel_format { srgb8, half, float32 };
 
 class rtw_image {
 public:
     rtw_image() {}
 
-    rtw_image(const char* image_filename) {
-        // Loads image data from the specified file. If the RTW_IMAGES environment variable is
-        // defined, looks only in that directory for the image file. If the image was not found,
-        // searches for the specified image file first from the current directory, then in the
-        // images/ subdirectory, then the _parent's_ images/ subdirectory, and then _that_
-        // parent, on so on, for six levels up. If the image was not loaded successfully,
-        // width() and height() will return 0.
-
-        auto filename = std::string(image_filename);
-        auto imagedir = getenv("RTW_IMAGES");
-
-        // Hunt for the image file in some likely locations.
-        if (imagedir && load(std::string(imagedir) + "/" + image_filename)) return;
-        if (load(filename)) return;
-        if (load("images/" + filename)) return;
-        if (load("../images/" + filename)) return;
-        if (load("../../images/" + filename)) return;
-        if (load("../../../images/" + filename)) return;
-        if (load("../../../../images/" + filename)) return;
-        if (load("../../../../../images/" + filename)) return;
-        if (load("../../../../../../images/" + filename)) return;
-
-        std::cerr << "ERROR: Could not load image file '" << image_filename << "'.\n";
-    }
-
-    ~rtw_image() {
-        delete[] bdata;
-        STBI_FREE(fdata);
-    }
-
-    bool load(const std::string& filename) {
-        // Loads the linear (gamma=1) image data from the given file name. Returns true if the
-        // load succeeded. The resulting data buffer contains the three [0.0, 1.0]
-        // floating-point values for the first pixel (red, then green, then blue). Pixels are
-        // contiguous, going left to right for the width of the image, followed by the next row
-        // below, for the full height of the image.
-
-        auto n = bytes_per_pixel; // Dummy out parameter: original components per pixel
-        fdata = stbi_loadf(filename.c_str(), &image_width, &image_height, &n, bytes_per_pixel);
-        if (fdata == nullptr) return false;
-
-        bytes_per_scanline = image_width * bytes_per_pixel;
-        convert_to_bytes();
+    // Images are found and shared through image_registry, which owns the search path.
+    rtw_image(const rtw_image&) = delete;
+    rtw_image& operator=(const rtw_image&) = delete;
+
+    bool load(const std::string& filename, texel_format format = texel_format::srgb8) {
+        // Loads the image and keeps a single copy of it, plus its MIP pyramid, in the requested
+        // format; the decoder's buffer is freed before returning. HDR images are never clipped to
+        // srgb8: asking for it stores them as half. Returns true if the load succeeded.
+        int n, w, h;
+        bool hdr = stbi_is_hdr(filename.c_str());
+
+        if (!hdr) {
+            auto bytes = stbi_load(filename.c_str(), &w, &h, &n, channels);
+            if (bytes == nullptr) return false;
+            allocate(w, h, format);
+            for (int y = 0; y < h; y++) {
+                for (int x = 0; x < w; x++) {
+                    const unsigned char* p = bytes + (size_t(y) * w + x) * channels;
+                    if (format == texel_format::srgb8) {
+                        std::memcpy(&data[texel_offset(levels[0], x, y)], p, channels);
+                    }
+                    else {
+                        auto lut = srgb_to_linear_table();
+                        store_linear(levels[0], x, y, color(lut[p[0]], lut[p[1]], lut[p[2]]));
+                    }
+                }
+            }
+            stbi_image_free(bytes);
+            build_mip_levels();
+            return true;
+        }
+
+        auto floats = stbi_loadf(filename.c_str(), &w, &h, &n, channels);
+        if (floats == nullptr) return false;
+        allocate(w, h, stored_format(filename, format));
+        for (int y = 0; y < h; y++) {
+            for (int x = 0; x < w; x++) {
+                const float* p = floats + (size_t(y) * w + x) * channels;
+                store_linear(levels[0], x, y, color(p[0], p[1], p[2]));
+            }
+        }
+        stbi_image_free(floats);
+        build_mip_levels();
         return true;
     }
 
-    int width()  const { return (fdata == nullptr) ? 0 : image_width; }
-    int height() const { return (fdata == nullptr) ? 0 : image_height; }
+    static texel_format stored_format(const std::string& filename, texel_format format) {
+        // The format load() keeps the file in when asked for `format`.
+        return format == texel_format::srgb8 && stbi_is_hdr(filename.c_str()) ? texel_format::half : format;
+    }
+
+    int width()  const { return levels.empty() ? 0 : levels[0].width; }
+    int height() const { return levels.empty() ? 0 : levels[0].height; }
+    int level_count() const { return int(levels.size()); }
+    texel_format format() const { return storage_format; }
+
+    size_t memory_usage() const { return data.capacity(); }
+
+    color texel(int x, int y, int level = 0) const {
+        // Returns the linear color of the texel at x,y of the given MIP level (0 being the full
+        // image), clamped to the level. If there is no image data, returns magenta.
+        if (levels.empty()) return color(1, 0, 1);
+
+        const auto& l = levels[level];
+        x = clamp(x, 0, l.width);
+        y = clamp(y, 0, l.height);
+
+        return decode(&data[texel_offset(l, x, y)], storage_format);
+    }
+
+    color bilinear(double s, double t, int level = 0) const {
+        // Bilinearly filtered color at continuous texel coordinates (s, t) of a MIP level.
+        return bilinear_filter([&](int x, int y) { return texel(x, y, level); }, s, t);
+    }
+
+    template <typename Texel>
+    static color bilinear_filter(const Texel& texel, double s, double t) {
+        // Bilinear filter over texel(x, y), which must clamp to its image, at continuous texel
+        // coordinates (s, t), where texel x,y covers [x, x+1) x [y, y+1).
+        s -= 0.5;
+        t -= 0.5;
+        auto x = int(std::floor(s)), y = int(std::floor(t));
+        auto fx = s - x, fy = t - y;
+        return (1 - fy) * ((1 - fx) * texel(x, y)     + fx * texel(x + 1, y))
+             +      fy  * ((1 - fx) * texel(x, y + 1) + fx * texel(x + 1, y + 1));
+    }
+
+    color trilinear(double s, double t, double lod) const {
+        // Filtered color at image coordinates (s, t) in [0,1] x [0,1], blending the two MIP
+        // levels around the level of detail `lod`: the base two log of the filter width in
+        // full-resolution texels.
+        if (levels.empty()) return color(1, 0, 1);
+
+        int last = int(levels.size()) - 1;
+        if (!(lod > 0)) return bilinear(s * levels[0].width, t * levels[0].height, 0);
+        if (lod >= last) return bilinear(s * levels[last].width, t * levels[last].height, last);
 
-    const unsigned char* pixel_data(int x, int y) const {
-        // Return the address of the three RGB bytes of the pixel at x,y. If there is no image
-        // data, returns magenta.
-        static unsigned char magenta[] = { 255, 0, 255 };
-        if (bdata == nullptr) return magenta;
+        int level = int(lod);
+        double f = lod - level;
+        const auto& fine = levels[level];
+        const auto& coarse = levels[level + 1];
+        return (1 - f) * bilinear(s * fine.width, t * fine.height, level)
+             +      f  * bilinear(s * coarse.width, t * coarse.height, level + 1);
+    }
 
-        x = clamp(x, 0, image_width);
-        y = clamp(y, 0, image_height);
+    static const char* format_name(texel_format format) {
+        switch (format) {
+            case texel_format::srgb8: return "srgb8";
+            case texel_format::half:  return "half";
+            default:                  return "float32";
+        }
+    }
 
-        return bdata + y * bytes_per_scanline + x * bytes_per_pixel;
+    static int bytes_per_texel_of(texel_format format) {
+        return channels * (format == texel_format::srgb8 ? 1 : format == texel_format::half ? 2 : 4);
     }
 
+    static color decode(const unsigned char* p, texel_format format) {
+        // Linear color of a texel stored in the given format.
+        switch (format) {
+            case texel_format::srgb8: {
+                auto lut = srgb_to_linear_table();
+                return color(lut[p[0]], lut[p[1]], lut[p[2]]);
+            }
+            case texel_format::half: {
+                uint16_t v[3];
+                std::memcpy(v, p, sizeof(v));
+                return color(half_to_float(v[0]), half_to_float(v[1]), half_to_float(v[2]));
+            }
+            default: {
+                float v[3];
+                std::memcpy(v, p, sizeof(v));
+                return color(v[0], v[1], v[2]);
+            }
+        }
+    }
+
+    friend class texture_cache;
+
 private:
-    const int      bytes_per_pixel = 3;
-    float* fdata = nullptr;         // Linear floating point pixel data
-    unsigned char* bdata = nullptr;         // Linear 8-bit pixel data
-    int            image_width = 0;         // Loaded image width
-    int            image_height = 0;        // Loaded image height
-    int            bytes_per_scanline = 0;
+    // Texels are stored in 8x8 tiles, each tile contiguous, so the four texels of a bilinear
+    // lookup (and the neighbouring lookups of nearby rays) share cache lines. The MIP levels
+    // follow the full image in the same buffer, each half the size of the one before.
+    static const int tile_size = 8;
+    static const int channels = 3;
+
+    struct mip_level {
+        int width, height;
+        int tiles_per_row;
+        size_t offset;  // Start of the level in data
+    };
+
+    std::vector<unsigned char> data;
+    std::vector<mip_level> levels;
+    int bytes_per_texel = 0;
+    texel_format storage_format = texel_format::srgb8;
+
+    void allocate(int w, int h, texel_format format) {
+        storage_format = format;
+        bytes_per_texel = bytes_per_texel_of(format);
+        levels.clear();
+        size_t size = 0;
+        while (true) {
+            auto tiles_per_row = (w + tile_size - 1) / tile_size;
+            auto tile_rows = (h + tile_size - 1) / tile_size;
+            levels.push_back(mip_level{ w, h, tiles_per_row, size });
+            size += size_t(tiles_per_row) * tile_rows * tile_size * tile_size * bytes_per_texel;
+            if (w == 1 && h == 1) break;
+            w = std::max(1, w / 2);
+            h = std::max(1, h / 2);
+        }
+        data.assign(size, 0);
+    }
+
+    void build_mip_levels() {
+        // Each texel of a level is the average of the 2x2 texels above it, in linear color.
+        for (size_t l = 1; l < levels.size(); l++) {
+            int level = int(l) - 1;
+            for (int y = 0; y < levels[l].height; y++) {
+                for (int x = 0; x < levels[l].width; x++) {
+                    auto sum = texel(2 * x, 2 * y, level) + texel(2 * x + 1, 2 * y, level)
+                             + texel(2 * x, 2 * y + 1, level) + texel(2 * x + 1, 2 * y + 1, level);
+                    store_linear(levels[l], x, y, 0.25 * sum);
+                }
+            }
+        }
+    }
+
+    size_t texel_offset(const mip_level& level, int x, int y) const {
+        size_t tile = size_t(y / tile_size) * level.tiles_per_row + x / tile_size;
+        size_t within = (y % tile_size) * tile_size + x % tile_size;
+        return level.offset + (tile * tile_size * tile_size + within) * bytes_per_texel;
+    }
+
+    void store_linear(const mip_level& level, int x, int y, const color& c) {
+        unsigned char* p = &data[texel_offset(level, x, y)];
+        float r = float(c.x()), g = float(c.y()), b = float(c.z());
+        if (storage_format == texel_format::half) {
+            uint16_t v[3] = { float_to_half(r), float_to_half(g), float_to_half(b) };
+            std::memcpy(p, v, sizeof(v));
+        }
+        else if (storage_format == texel_format::float32) {
+            float v[3] = { r, g, b };
+            std::memcpy(p, v, sizeof(v));
+        }
+        else {
+            p[0] = linear_to_srgb_byte(r);
+            p[1] = linear_to_srgb_byte(g);
+            p[2] = linear_to_srgb_byte(b);
+        }
+    }
 
     static int clamp(int x, int low, int high) {
         // Return the value clamped to the range [low, high).
@@ -93,28 +247,65 @@ private:
         return high - 1;
     }
 
-    static unsigned char float_to_byte(float value) {
-        if (value <= 0.0)
-            return 0;
-        if (1.0 <= value)
-            return 255;
-        return static_cast<unsigned char>(256.0 * value);
+    static const float* srgb_to_linear_table() {
+        static const std::vector<float> table = []() {
+            std::vector<float> t(256);
+            for (int i = 0; i < 256; i++) {
+                double c = i / 255.0;
+                t[i] = float(c <= 0.04045 ? c / 12.92 : std::pow((c + 0.055) / 1.055, 2.4));
+            }
+            return t;
+        }();
+        return table.data();
     }
 
-    void convert_to_bytes() {
-        // Convert the linear floating point pixel data to bytes, storing the resulting byte
-        // data in the `bdata` member.
+    static unsigned char linear_to_srgb_byte(float value) {
+        if (!(value > 0)) return 0;
+        if (value >= 1) return 255;
+        double c = value <= 0.0031308 ? 12.92 * value : 1.055 * std::pow(value, 1 / 2.4) - 0.055;
+        return static_cast<unsigned char>(c * 255 + 0.5);
+    }
 
-        int total_bytes = image_width * image_height * bytes_per_pixel;
-        bdata = new unsigned char[total_bytes];
+    static uint16_t float_to_half(float value) {
+        // IEEE 754 binary16, rounding to nearest even.
+        uint32_t x;
+        std::memcpy(&x, &value, sizeof(x));
+        uint32_t sign = (x >> 16) & 0x8000;
+        int exponent = int((x >> 23) & 0xff) - 127 + 15;
+        uint32_t mantissa = x & 0x7fffff;
 
-        // Iterate through all pixel components, converting from [0.0, 1.0] float values to
-        // unsigned [0, 255] byte values.
+        if (((x >> 23) & 0xff) == 0xff) return uint16_t(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+        if (exponent >= 31) return uint16_t(sign | 0x7c00);
+        if (exponent <= 0) {
+            // Subnormal half, or zero.
+            if (exponent < -10) return uint16_t(sign);
+            mantissa |= 0x800000;
+            int shift = 14 - exponent;
+            uint32_t h = mantissa >> shift;
+            uint32_t rest = mantissa & ((1u << shift) - 1), halfway = 1u << (shift - 1);
+            if (rest > halfway || (rest == halfway && (h & 1))) h++;
+            return uint16_t(sign | h);
+        }
+        uint32_t h = sign | (uint32_t(exponent) << 10) | (mantissa >> 13);
+        uint32_t rest = mantissa & 0x1fff;
+        if (rest > 0x1000 || (rest == 0x1000 && (h & 1))) h++;  // May carry into the exponent
+        return uint16_t(h);
+    }
 
-        auto* bptr = bdata;
-        auto* fptr = fdata;
-        for (auto i = 0; i < total_bytes; i++, fptr++, bptr++)
-            *bptr = float_to_byte(*fptr);
+    static float half_to_float(uint16_t h) {
+        uint32_t sign = uint32_t(h & 0x8000) << 16;
+        uint32_t exponent = (h >> 10) & 0x1f;
+        uint32_t mantissa = h & 0x3ff;
+        if (exponent == 0) {
+            float f = mantissa * (1.0f / 16777216.0f);  // Subnormal: mantissa * 2^-24
+            return sign ? -f : f;
+        }
+        uint32_t bits = exponent == 31
+            ? sign | 0x7f800000 | (mantissa << 13)
+            : sign | ((exponent + 112) << 23) | (mantissa << 13);
+        float f;
+        std::memcpy(&f, &bits, sizeof(f));
+        return f;
     }
 };
 
@@ -123,4 +314,4 @@ private:
 #pragma warning (pop)
 #endif
 
-#endif
\ No newline at end of file
+#endif
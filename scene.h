@@ -0,0 +1,176 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include "affine.h"
+#include "box.h"
+#include "bvh.h"
+#include "hittable_list.h"
+#include "instance.h"
+#include "quad.h"
+#include "sphere.h"
+#include "trace.h"
+
+#include <chrono>
+#include <typeinfo>
+#include <unordered_map>
+
+class scene {
+public:
+	hittable_list world;
+	hittable_list lights;
+
+	scene(const hittable_list& world, const hittable_list& lights) : world(world), lights(lights) {}
+
+	void compile() {
+		// Replaces the world by a flat list of primitives under a single bvh_tree. Nested lists
+		// and bvh_nodes are dissolved, chains of translate, rotate_y and instance collapse into
+		// one transform, and that transform is baked into the primitive where the result is
+		// exact: translated spheres, quads under orientation-preserving transforms and boxes
+		// under rigid ones. Everything else keeps a single instance. Subtrees shared between
+		// several parents stay shared, so instanced models are not copied.
+		auto start = std::chrono::steady_clock::now();
+
+		parent_counts.clear();
+		for (const auto& object : world.objects) count_parents(object.get());
+		hittable_list flat;
+		for (const auto& object : world.objects) flatten(object, affine(), flat);
+		parent_counts.clear();
+		auto object_count = flat.objects.size();
+
+		hittable_list compiled;
+		if (!flat.objects.empty()) {
+			trace_scope scope("build bvh", "build", "primitives", int64_t(object_count));
+			compiled.add(make_shared<bvh_tree>(flat));
+		}
+
+		auto end = std::chrono::steady_clock::now();
+		auto compile_ms = std::chrono::duration<double, std::milli>(end - start).count();
+
+		std::clog << "Scene compile: " << object_count << " primitives in " << compile_ms << " ms\n";
+
+		world = compiled;
+	}
+
+	static double probe_ray_cost(const hittable& objects, const std::vector<ray>& rays) {
+		// Average time of one closest-hit query in nanoseconds, on the calling thread. The first
+		// pass only warms the caches. Each pass stops after a fixed time budget, so an
+		// unaccelerated world with millions of objects is sampled with fewer rays instead of
+		// stalling the render.
+		const auto budget = std::chrono::milliseconds(250);
+		double elapsed = 0;
+		size_t traced = 0;
+		for (int pass = 0; pass < 2; pass++) {
+			auto start = std::chrono::steady_clock::now();
+			traced = 0;
+			for (const auto& r : rays) {
+				hit_record rec;
+				objects.hit(r, interval(0.001, infinity), rec);
+				traced++;
+				if ((traced & 15) == 0 && std::chrono::steady_clock::now() - start > budget) break;
+			}
+			auto end = std::chrono::steady_clock::now();
+			elapsed = std::chrono::duration<double, std::nano>(end - start).count();
+		}
+		return traced == 0 ? 0 : elapsed / traced;
+	}
+
+private:
+	// How many parents in the world reference each object. use_count() would not do: it also
+	// counts references from outside the world, and arena handles count nothing.
+	std::unordered_map<const hittable*, int> parent_counts;
+
+	void count_parents(const hittable* object) {
+		if (parent_counts[object]++ > 0) return;
+		const auto& type = typeid(*object);
+		if (type == typeid(hittable_list)) {
+			for (const auto& child : static_cast<const hittable_list*>(object)->objects) count_parents(child.get());
+		}
+		else if (type == typeid(bvh_node)) {
+			const auto* node = static_cast<const bvh_node*>(object);
+			count_parents(node->left.get());
+			if (node->right != node->left) count_parents(node->right.get());
+		}
+		else if (type == typeid(bvh_tree)) {
+			for (const auto& child : static_cast<const bvh_tree*>(object)->objects) count_parents(child.get());
+		}
+		else if (type == typeid(translate)) {
+			count_parents(static_cast<const translate*>(object)->object.get());
+		}
+		else if (type == typeid(rotate_y)) {
+			count_parents(static_cast<const rotate_y*>(object)->object.get());
+		}
+		else if (type == typeid(instance)) {
+			count_parents(static_cast<const instance*>(object)->object.get());
+		}
+	}
+
+	void flatten(const shared_ptr<hittable>& object, const affine& transform, hittable_list& out) {
+		const auto& type = typeid(*object);
+		bool identity = transform.is_translation() && transform.m[0][3] == 0
+					 && transform.m[1][3] == 0 && transform.m[2][3] == 0;
+
+		if (type == typeid(hittable_list) || type == typeid(bvh_node) || type == typeid(bvh_tree)) {
+			// A shared subtree under a transform is an instanced model: keep it whole.
+			if (!identity && parent_counts[object.get()] > 1) {
+				out.add(make_shared<instance>(object, transform));
+			}
+			else if (type == typeid(hittable_list)) {
+				for (const auto& child : static_cast<const hittable_list&>(*object).objects)
+					flatten(child, transform, out);
+			}
+			else if (type == typeid(bvh_node)) {
+				const auto& node = static_cast<const bvh_node&>(*object);
+				flatten(node.left, transform, out);
+				if (node.right != node.left) flatten(node.right, transform, out);
+			}
+			else {
+				for (const auto& child : static_cast<const bvh_tree&>(*object).objects)
+					flatten(child, transform, out);
+			}
+		}
+		else if (type == typeid(translate)) {
+			const auto& t = static_cast<const translate&>(*object);
+			flatten(t.object, transform * affine::translation(t.offset), out);
+		}
+		else if (type == typeid(rotate_y)) {
+			const auto& rot = static_cast<const rotate_y&>(*object);
+			affine rotation;
+			rotation.m[0][0] = rot.cos_theta;  rotation.m[0][2] = rot.sin_theta;
+			rotation.m[2][0] = -rot.sin_theta; rotation.m[2][2] = rot.cos_theta;
+			flatten(rot.object, transform * rotation, out);
+		}
+		else if (type == typeid(instance)) {
+			const auto& inst = static_cast<const instance&>(*object);
+			flatten(inst.object, transform * inst.object_to_world, out);
+		}
+		else if (identity) {
+			out.add(object);
+		}
+		else if (type == typeid(sphere) && transform.is_translation()) {
+			// Only translations: a rotated sphere would rotate its texture coordinates.
+			const auto& s = static_cast<const sphere&>(*object);
+			out.add(make_shared<sphere>(transform.transform_point(s.center), s.radius, s.mat));
+		}
+		else if (type == typeid(quad) && transform.determinant() > 0) {
+			const auto& q = static_cast<const quad&>(*object);
+			out.add(make_shared<quad>(transform.transform_point(q.Q),
+				transform.transform_vector(q.u), transform.transform_vector(q.v), q.mat));
+		}
+		else if (type == typeid(box) && transform.is_rigid()) {
+			const auto& b = static_cast<const box&>(*object);
+			if (!b.oriented && transform.is_translation()) {
+				auto offset = transform.transform_point(point3(0, 0, 0));
+				out.add(make_shared<box>(b.min + offset, b.max + offset, b.mat));
+			}
+			else {
+				auto placement = b.oriented ? transform * b.local_to_world : transform;
+				out.add(make_shared<box>(b.min, b.max, placement, b.mat));
+			}
+		}
+		else {
+			out.add(make_shared<instance>(object, transform));
+		}
+	}
+};
+
+#endif // !SCENE_H
@@ -0,0 +1,479 @@
+#ifndef SCENES_H
+#define SCENES_H
+
+#include "rtweekend.h"
+
+#include "bvh.h"
+#include "camera.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "instance.h"
+#include "interner.h"
+#include "material.h"
+#include "sphere.h"
+#include "sphere_set.h"
+#include "aabb.h"
+#include "arena.h"
+#include "box.h"
+#include "texture.h"
+#include "texture_bake.h"
+#include "texture_cache.h"
+#include "perlin.h"
+#include "quad.h"
+#include "onb.h"
+#include "pdf.h"
+
+#include <functional>
+#include <string>
+#include <vector>
+
+// The example scenes. Each fills a scene_setup, which the caller renders with
+// s.cam.render(s.world, s.lights) and then calls s.after_render, if set.
+
+struct scene_setup {
+    arena objects;                      // Owns the objects a scene makes through it
+    hittable_list world;
+    hittable_list lights;
+    camera cam;
+    std::function<void()> after_render; // Reports statistics gathered while rendering
+};
+
+inline void add_sphere_field(arena& objects, interner& library, hittable_list& world, int extent) {
+    // A checkered ground with small random spheres on the unit grid cells in [-extent, extent)^2.
+    auto checker = library.intern<checker_texture>(1.28,
+        library.intern<solid_color>(color(.4, .4, .4)), library.intern<solid_color>(color(.6, .6, .6)));
+    world.add(objects.make<sphere>(point3(0, -1000, 0), 1000, library.intern<lambertian>(checker)));
+
+    for (int a = -extent; a < extent; a++) {
+        for (int b = -extent; b < extent; b++) {
+            auto choose_mat = random_double();
+            point3 center(a + 0.9 * random_double(), 0.2, b + 0.9 * random_double());
+
+            if ((center - point3(4, 0.2, 0)).length() > 0.9) {
+                shared_ptr<material> sphere_material;
+
+                if (choose_mat < 0.8) {
+                    // diffuse
+                    auto albedo = color::random() * color::random();
+                    sphere_material = library.intern<lambertian>(library.intern<solid_color>(albedo));
+                    world.add(objects.make<sphere>(center, 0.2, sphere_material));
+                }
+                else if (choose_mat < 0.95) {
+                    // metal
+                    auto albedo = color::random(0.5, 1);
+                    auto fuzz = random_double(0, 0.5);
+                    sphere_material = library.intern<metal>(albedo, fuzz);
+                    world.add(objects.make<sphere>(center, 0.2, sphere_material));
+                }
+                else {
+                    // glass
+                    sphere_material = library.intern<dielectric>(1.5);
+                    world.add(objects.make<sphere>(center, 0.2, sphere_material));
+                }
+            }
+        }
+    }
+
+    auto material1 = library.intern<dielectric>(1.5);
+    world.add(objects.make<sphere>(point3(0, 1, 0), 1.0, material1));
+
+    auto material2 = library.intern<lambertian>(library.intern<solid_color>(color(0.4, 0.2, 0.1)));
+    world.add(objects.make<sphere>(point3(-4, 1, 0), 1.0, material2));
+
+    auto material3 = library.intern<metal>(color(0.7, 0.6, 0.5), 0.0);
+    world.add(objects.make<sphere>(point3(4, 1, 0), 1.0, material3));
+}
+
+inline void spheres(scene_setup& s, int extent = 11) {
+    interner library(s.objects);
+
+    add_sphere_field(s.objects, library, s.world, extent);
+    library.clear();
+    library.report(std::clog);
+
+    auto& cam = s.cam;
+
+    cam.aspect_ratio = 16.0 / 9.0;
+    cam.image_width = 800;
+    cam.samples_per_pixel = 40;
+    cam.max_depth = 20;
+
+    cam.vfov = 20;
+    cam.lookfrom = point3(13, 2, 3);
+    cam.lookat = point3(0, 0, 0);
+    cam.vup = vec3(0, 1, 0);
+    cam.background = color(0.70, 0.80, 1.00);
+
+    cam.defocus_angle = 0.6;
+    cam.focus_dist = 10.0;
+}
+
+inline void million_spheres(scene_setup& s) {
+    // spheres() on a 1000 x 1000 grid.
+    auto start = std::chrono::steady_clock::now();
+    interner library(s.objects);
+
+    add_sphere_field(s.objects, library, s.world, 500);
+    library.clear();
+
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start);
+    std::clog << "Built " << s.world.objects.size() << " spheres in " << elapsed.count() << " s; arena holds "
+              << s.objects.object_count() << " objects in " << s.objects.memory_usage() / (1 << 20) << " MB\n";
+    library.report(std::clog);
+
+    auto& cam = s.cam;
+
+    cam.aspect_ratio = 16.0 / 9.0;
+    cam.image_width = 400;
+    cam.samples_per_pixel = 20;
+    cam.max_depth = 20;
+
+    cam.vfov = 20;
+    cam.lookfrom = point3(13, 2, 3);
+    cam.lookat = point3(0, 0, 0);
+    cam.vup = vec3(0, 1, 0);
+    cam.background = color(0.70, 0.80, 1.00);
+
+    cam.defocus_angle = 0.6;
+    cam.focus_dist = 10.0;
+}
+
+inline void checkered_spheres(scene_setup& s) {
+    auto& world = s.world;
+
+    auto checker = make_shared<checker_texture>(0.32, color(.2, .3, .1), color(.9, .9, .9));
+
+    world.add(make_shared<sphere>(point3(0, -10, 0), 10, make_shared<lambertian>(checker)));
+    world.add(make_shared<sphere>(point3(0, 10, 0), 10, make_shared<lambertian>(checker)));
+
+    auto& cam = s.cam;
+
+    cam.aspect_ratio = 16.0 / 9.0;
+    cam.image_width = 400;
+    cam.samples_per_pixel = 50;
+    cam.max_depth = 20;
+    cam.background = color(0.70, 0.80, 1.00);
+
+    cam.vfov = 20;
+    cam.lookfrom = point3(13, 2, 3);
+    cam.lookat = point3(0, 0, 0);
+    cam.vup = vec3(0, 1, 0);
+
+    cam.defocus_angle = 0;
+}
+
+inline void earth(scene_setup& s) {
+    auto earth_texture = make_shared<image_texture>("earthmap.jpg");
+    auto earth_surface = make_shared<lambertian>(earth_texture);
+    s.world.add(make_shared<sphere>(point3(0, 0, 0), 2, earth_surface));
+
+    auto& cam = s.cam;
+
+    cam.aspect_ratio = 16.0 / 9.0;
+    cam.image_width = 400;
+    cam.samples_per_pixel = 100;
+    cam.max_depth = 50;
+    cam.background = color(0.70, 0.80, 1.00);
+
+    cam.vfov = 20;
+    cam.lookfrom = point3(0, 0, 12);
+    cam.lookat = point3(0, 0, 0);
+    cam.vup = vec3(0, 1, 0);
+
+    cam.defocus_angle = 0;
+}
+
+inline void earth_out_of_core(scene_setup& s) {
+    // earth(), with the map read through the texture cache under a budget far smaller than
+    // the image, to exercise tile faulting and eviction.
+    texture_cache::global().set_budget(256 * 1024);
+    auto earth_texture = make_shared<cached_image_texture>("earthmap.jpg");
+    auto earth_surface = make_shared<lambertian>(earth_texture);
+    s.world.add(make_shared<sphere>(point3(0, 0, 0), 2, earth_surface));
+
+    auto& cam = s.cam;
+
+    cam.aspect_ratio = 16.0 / 9.0;
+    cam.image_width = 400;
+    cam.samples_per_pixel = 100;
+    cam.max_depth = 50;
+    cam.background = color(0.70, 0.80, 1.00);
+
+    cam.vfov = 20;
+    cam.lookfrom = point3(0, 0, 12);
+    cam.lookat = point3(0, 0, 0);
+    cam.vup = vec3(0, 1, 0);
+
+    cam.defocus_angle = 0;
+
+    s.after_render = [] { texture_cache::global().report(std::clog); };
+}
+
+inline void perlin_spheres(scene_setup& s, bool baked = false) {
+    auto& world = s.world;
+
+    // Baked: the sphere's noise is cached in a uv atlas. The ground stays live; it reaches the
+    // horizon, so caching it costs more evaluations than rendering it does.
+    auto pertext = make_shared<noise_texture>(4, 5);
+    shared_ptr<texture> ball_texture = pertext;
+    if (baked)
+        ball_texture = uv_atlas_texture::for_sphere(pertext, point3(0, 2, 0), 2, 1024);
+    world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, make_shared<lambertian>(pertext)));
+    world.add(make_shared<sphere>(point3(0, 2, 0), 2, make_shared<lambertian>(ball_texture)));
+
+    auto& cam = s.cam;
+
+    cam.aspect_ratio = 16.0 / 9.0;
+    cam.image_width = 400;
+    cam.samples_per_pixel = 100;
+    cam.max_depth = 50;
+    cam.background = color(0.70, 0.80, 1.00);
+
+    cam.vfov = 20;
+    cam.lookfrom = point3(13, 2, 3);
+    cam.lookat = point3(0, 0, 0);
+    cam.vup = vec3(0, 1, 0);
+
+    cam.defocus_angle = 0;
+}
+
+inline void quads(scene_setup& s) {
+    auto& world = s.world;
+
+    // Materials
+    auto left_red = make_shared<lambertian>(color(1.0, 0.2, 0.2));
+    auto back_green = make_shared<lambertian>(color(0.2, 1.0, 0.2));
+    auto right_blue = make_shared<lambertian>(color(0.2, 0.2, 1.0));
+    auto upper_orange = make_shared<lambertian>(color(1.0, 0.5, 0.0));
+    auto lower_teal = make_shared<lambertian>(color(0.2, 0.8, 0.8));
+
+    // Quads
+    world.add(make_shared<quad>(point3(-3, -2, 5), vec3(0, 0, -4), vec3(0, 4, 0), left_red));
+    world.add(make_shared<quad>(point3(-2, -2, 0), vec3(4, 0, 0), vec3(0, 4, 0), back_green));
+    world.add(make_shared<quad>(point3(3, -2, 1), vec3(0, 0, 4), vec3(0, 4, 0), right_blue));
+    world.add(make_shared<quad>(point3(-2, 3, 1), vec3(4, 0, 0), vec3(0, 0, 4), upper_orange));
+    world.add(make_shared<quad>(point3(-2, -3, 5), vec3(4, 0, 0), vec3(0, 0, -4), lower_teal));
+
+    auto& cam = s.cam;
+
+    cam.aspect_ratio = 1.0;
+    cam.image_width = 400;
+    cam.samples_per_pixel = 100;
+    cam.max_depth = 50;
+    cam.background = color(0.70, 0.80, 1.00);
+
+    cam.vfov = 80;
+    cam.lookfrom = point3(0, 0, 9);
+    cam.lookat = point3(0, 0, 0);
+    cam.vup = vec3(0, 1, 0);
+
+    cam.defocus_angle = 0;
+}
+
+inline void simple_light(scene_setup& s, bool baked = false) {
+    auto& world = s.world;
+    auto& lights = s.lights;
+
+    // Baked as in perlin_spheres().
+    auto pertext = make_shared<noise_texture>(4, 7);
+    shared_ptr<texture> ball_texture = pertext;
+    if (baked)
+        ball_texture = uv_atlas_texture::for_sphere(pertext, point3(0, 2, 0), 2, 1024);
+    world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, make_shared<lambertian>(pertext)));
+    world.add(make_shared<sphere>(point3(0, 2, 0), 2, make_shared<lambertian>(ball_texture)));
+
+    auto difflight = make_shared<diffuse_light>(color(4, 4, 4));
+    world.add(make_shared<quad>(point3(3, 1, -2), vec3(2, 0, 0), vec3(0, 2, 0), difflight));
+    lights.add(make_shared<quad>(point3(3, 1, -2), vec3(2, 0, 0), vec3(0, 2, 0), difflight));
+    auto& cam = s.cam;
+
+    cam.aspect_ratio = 16.0 / 9.0;
+    cam.image_width = 400;
+    cam.samples_per_pixel = 100;
+    cam.max_depth = 50;
+    cam.background = color(0, 0, 0);
+
+    cam.vfov = 20;
+    cam.lookfrom = point3(26, 3, 6);
+    cam.lookat = point3(0, 2, 0);
+    cam.vup = vec3(0, 1, 0);
+
+    cam.defocus_angle = 0;
+}
+
+inline void cornell_box(scene_setup& s) {
+    //world
+    auto& world = s.world;
+
+    //materials
+    auto red = make_shared<lambertian>(color(.65, .05, .05));
+    auto white = make_shared<lambertian>(color(.73, .73, .73));
+    auto green = make_shared<lambertian>(color(.12, .45, .15));
+    auto light = make_shared<diffuse_light>(color(15, 15, 15));
+
+    //walls
+    world.add(make_shared<quad>(point3(555, 0, 0), vec3(0, 555, 0), vec3(0, 0, 555), green));
+    world.add(make_shared<quad>(point3(0, 0, 0), vec3(0, 555, 0), vec3(0, 0, 555), red));
+    world.add(make_shared<quad>(point3(0, 0, 0), vec3(555, 0, 0), vec3(0, 0, 555), white));
+    world.add(make_shared<quad>(point3(555, 555, 555), vec3(-555, 0, 0), vec3(0, 0, -555), white));
+    world.add(make_shared<quad>(point3(0, 0, 555), vec3(555, 0, 0), vec3(0, 555, 0), white));
+
+    //light
+    world.add(make_shared<quad>(point3(343, 554, 332), vec3(-130, 0, 0), vec3(0, 0, -105), light));
+
+    //box1
+    auto box1_placement = affine::translation(vec3(265, 0, 295)) * affine::rotation_y(15);
+    world.add(make_shared<box>(point3(0, 0, 0), point3(165, 330, 165), box1_placement, white));
+    //shared_ptr<material> aluminum = make_shared<metal>(color(0.8, 0.85, 0.88), 0.0);
+    //world.add(make_shared<box>(point3(0, 0, 0), point3(165, 330, 165), box1_placement, aluminum));
+
+    // Glass Sphere
+    auto glass = make_shared<dielectric>(1.5);
+    world.add(make_shared<sphere>(point3(190, 90, 190), 90, glass));
+
+    ////box2
+    //auto box2_placement = affine::translation(vec3(130, 0, 65)) * affine::rotation_y(-18);
+    //world.add(make_shared<box>(point3(0, 0, 0), point3(165, 165, 165), box2_placement, white));
+
+    //light list
+    auto empty_material = shared_ptr<material>();    
+    auto& lights = s.lights;
+    lights.add(
+        make_shared<quad>(point3(343, 554, 332), vec3(-130, 0, 0), vec3(0, 0, -105), empty_material));
+    lights.add(make_shared<sphere>(point3(190, 90, 190), 90, empty_material));
+
+    //camera
+    auto& cam = s.cam;
+
+    cam.aspect_ratio = 1.0;
+    cam.image_width = 400;
+    cam.samples_per_pixel = 20;
+    cam.max_depth = 20;
+    cam.background = color(0, 0, 0);
+
+    cam.vfov = 40;
+    cam.lookfrom = point3(278, 278, -800);
+    cam.lookat = point3(278, 278, 0);
+    cam.vup = vec3(0, 1, 0);
+
+    cam.defocus_angle = 0;
+}
+
+inline void instances(scene_setup& s, int extent = 50) {
+    auto& world = s.world;
+
+    auto checker = make_shared<checker_texture>(1.28, color(.4, .4, .4), color(.6, .6, .6));
+    world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, make_shared<lambertian>(checker)));
+
+    // One bottom-level BVH for the model, shared by every instance.
+    hittable_list model_parts;
+    auto white = make_shared<lambertian>(color(.73, .73, .73));
+    auto gold = make_shared<metal>(color(0.8, 0.6, 0.2), 0.1);
+    model_parts.add(make_shared<sphere>(point3(0, 0.3, 0), 0.3, white));
+    model_parts.add(make_shared<sphere>(point3(0, 0.75, 0), 0.2, white));
+    model_parts.add(make_shared<sphere>(point3(0.25, 0.75, 0), 0.08, gold));
+    model_parts.add(make_shared<quad>(point3(-0.3, 0, -0.3), vec3(0.6, 0, 0), vec3(0, 0, 0.6), gold));
+    auto model = make_shared<bvh_node>(model_parts);
+
+    // Top-level BVH over the instances.
+    hittable_list instances;
+    for (int a = -extent; a < extent; a++) {
+        for (int b = -extent; b < extent; b++) {
+            auto scale = random_double(0.5, 1.0);
+            auto xform = affine::translation(point3(a * 0.6, 0, b * 0.6))
+                       * affine::rotation_y(random_double(0, 360))
+                       * affine::scaling(vec3(scale, scale, scale));
+            instances.add(make_shared<instance>(model, xform));
+        }
+    }
+    world.add(make_shared<bvh_node>(instances));
+
+    auto& cam = s.cam;
+
+    cam.aspect_ratio = 16.0 / 9.0;
+    cam.image_width = 400;
+    cam.samples_per_pixel = 50;
+    cam.max_depth = 20;
+    cam.background = color(0.70, 0.80, 1.00);
+
+    cam.vfov = 30;
+    cam.lookfrom = point3(13, 4, 3);
+    cam.lookat = point3(0, 0, 0);
+    cam.vup = vec3(0, 1, 0);
+
+    cam.defocus_angle = 0;
+}
+
+inline void particles(scene_setup& s, int count = 200000) {
+    auto& world = s.world;
+
+    auto checker = make_shared<checker_texture>(1.28, color(.4, .4, .4), color(.6, .6, .6));
+    world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, make_shared<lambertian>(checker)));
+
+    // A small palette of materials shared by all particles.
+    std::vector<shared_ptr<material>> palette;
+    for (int i = 0; i < 6; i++)
+        palette.push_back(make_shared<lambertian>(color::random(0.2, 0.9)));
+    palette.push_back(make_shared<metal>(color(0.8, 0.8, 0.9), 0.05));
+    palette.push_back(make_shared<dielectric>(1.5));
+
+    auto cloud = make_shared<sphere_set>();
+    for (int i = 0; i < count; i++) {
+        auto center = point3(random_double(-8, 8), random_double(0.05, 3), random_double(-8, 8));
+        cloud->add(center, 0.04, palette[random_int(0, int(palette.size()) - 1)]);
+    }
+    cloud->build();
+    world.add(cloud);
+
+    auto& cam = s.cam;
+
+    cam.aspect_ratio = 16.0 / 9.0;
+    cam.image_width = 400;
+    cam.samples_per_pixel = 50;
+    cam.max_depth = 20;
+    cam.background = color(0.70, 0.80, 1.00);
+
+    cam.vfov = 30;
+    cam.lookfrom = point3(13, 4, 3);
+    cam.lookat = point3(0, 1, 0);
+    cam.vup = vec3(0, 1, 0);
+
+    cam.defocus_angle = 0;
+}
+
+struct scene_entry {
+    const char* name;
+    void (*build)(scene_setup& s);
+};
+
+inline const std::vector<scene_entry>& scene_catalog() {
+    // Every scene by name, in the order of main()'s switch, followed by scaled-up variants
+    // of the scenes whose cost grows with their object count.
+    static const std::vector<scene_entry> scenes = {
+        { "spheres", [](scene_setup& s) { spheres(s); } },
+        { "checkered_spheres", checkered_spheres },
+        { "earth", earth },
+        { "perlin_spheres", [](scene_setup& s) { perlin_spheres(s); } },
+        { "quads", quads },
+        { "simple_light", [](scene_setup& s) { simple_light(s); } },
+        { "cornell_box", cornell_box },
+        { "instances", [](scene_setup& s) { instances(s); } },
+        { "particles", [](scene_setup& s) { particles(s); } },
+        { "million_spheres", million_spheres },
+        { "earth_out_of_core", earth_out_of_core },
+        { "perlin_spheres_baked", [](scene_setup& s) { perlin_spheres(s, true); } },
+        { "simple_light_baked", [](scene_setup& s) { simple_light(s, true); } },
+        { "spheres_x16", [](scene_setup& s) { spheres(s, 44); } },
+        { "instances_x9", [](scene_setup& s) { instances(s, 150); } },
+        { "particles_x5", [](scene_setup& s) { particles(s, 1000000); } },
+    };
+    return scenes;
+}
+
+inline const scene_entry* find_scene(const std::string& name) {
+    for (const auto& entry : scene_catalog())
+        if (name == entry.name) return &entry;
+    return nullptr;
+}
+
+#endif // !SCENES_H
@@ -1,7 +1,8 @@
 #ifndef SPHERE_H
-#define SPHERE
+#define SPHERE_H
 
 #include "hittable.h"
+#include "onb.h"
 
 class sphere : public hittable {
 public:
@@ -13,6 +14,7 @@ public:
     }
 
 	bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        RT_STAT(STAT_SPHERE_TESTS);
         vec3 oc = center - r.origin();
         auto a = r.direction().length_squared();
         auto h = dot(r.direction(), oc);
@@ -34,11 +36,13 @@ public:
         vec3 outward_normal = (rec.p - center) / radius;
         rec.set_face_normal(r, outward_normal);
         get_sphere_uv(outward_normal, rec.u, rec.v);
-        rec.mat = mat;
+        get_sphere_derivatives(outward_normal, radius, rec.dpdu, rec.dpdv);
+        rec.mat = mat.get();
         return true;
     }
 
     double pdf_value(const point3& origin, const vec3& direction) const override {
+        RT_STAT(STAT_SHADOW_RAYS);
         hit_record rec;
         if (!this->hit(ray(origin, direction), interval(0.001, infinity), rec))
             return 0;
@@ -58,13 +62,6 @@ public:
 
     aabb bounding_box() const override { return bbox; }
 
-
-private:
-	point3 center;
-	double radius;
-    shared_ptr<material> mat;
-    aabb bbox;
-
     static void get_sphere_uv(const point3& p, double& u, double& v) {
         auto theta = std::acos(-p.y());
         auto phi = std::atan2(-p.z(), p.x()) + pi;
@@ -73,6 +70,26 @@ private:
         v = theta / pi;
     }
 
+    static void get_sphere_derivatives(const point3& p, double radius, vec3& dpdu, vec3& dpdv) {
+        // p: a given point on the sphere of radius one, centered at the origin.
+        // dpdu, dpdv: change of the point on a sphere of the given radius along the u and v
+        // of get_sphere_uv. dpdv is degenerate at the poles.
+        auto sin_theta = std::sqrt(p.x() * p.x() + p.z() * p.z());
+        dpdu = 2 * pi * radius * vec3(p.z(), 0, -p.x());
+        if (sin_theta > 0)
+            dpdv = pi * radius * vec3(-p.y() * p.x() / sin_theta, sin_theta, -p.y() * p.z() / sin_theta);
+        else
+            dpdv = vec3(0, 0, 0);
+    }
+
+    friend class compiled_scene;
+    friend class scene;
+private:
+	point3 center;
+	double radius;
+    shared_ptr<material> mat;
+    aabb bbox;
+
     static vec3 random_to_sphere(double radius, double distance_squared) {
         auto r1 = random_double();
         auto r2 = random_double();
@@ -0,0 +1,174 @@
+#ifndef SPHERE_SET_H
+#define SPHERE_SET_H
+
+#include "flat_bvh.h"
+#include "hittable.h"
+#include "sphere.h"
+
+#include <limits>
+#include <unordered_map>
+#include <vector>
+
+class sphere_set : public hittable {
+public:
+	// Stores many spheres as structure-of-arrays: center, radius and a material index, 20
+	// bytes per sphere. Call build() once all spheres are added; a set that has not been
+	// built is never hit. Adding to a built set unbuilds it until build() is called again.
+
+	void add(const point3& center, double radius, shared_ptr<material> mat) {
+		if (padded) unbuild();
+		radius = std::fmax(0, radius);
+		cx.push_back(float(center.x()));
+		cy.push_back(float(center.y()));
+		cz.push_back(float(center.z()));
+		radii.push_back(float(radius));
+		material_indices.push_back(material_index(mat));
+
+		auto rvec = vec3(radius, radius, radius);
+		bbox = aabb(bbox, aabb(center - rvec, center + rvec));
+	}
+
+	void build() {
+		auto n = size();
+		std::vector<flat_bvh::build_prim> prims(n);
+		for (size_t i = 0; i < n; i++) {
+			float lo[3] = { cx[i] - radii[i], cy[i] - radii[i], cz[i] - radii[i] };
+			float hi[3] = { cx[i] + radii[i], cy[i] + radii[i], cz[i] + radii[i] };
+			prims[i].bounds.grow(lo);
+			prims[i].bounds.grow(hi);
+			prims[i].index = uint32_t(i);
+		}
+		auto order = bvh.build(std::move(prims), lanes, lanes);
+
+		permute(cx, order);
+		permute(cy, order);
+		permute(cz, order);
+		permute(radii, order);
+		permute(material_indices, order);
+
+		// Pad with spheres that can never be hit, so the leaf test can always read a full
+		// group of lanes without a remainder loop.
+		auto nan = std::numeric_limits<float>::quiet_NaN();
+		for (int k = 0; k < lanes - 1; k++) {
+			cx.push_back(nan);
+			cy.push_back(nan);
+			cz.push_back(nan);
+			radii.push_back(0);
+			material_indices.push_back(0);
+		}
+		padded = true;
+		material_lookup.clear();
+	}
+
+	bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+		if (!padded) return false;
+
+		const double ox = r.origin().x(), oy = r.origin().y(), oz = r.origin().z();
+		const double dx = r.direction().x(), dy = r.direction().y(), dz = r.direction().z();
+		const double a = r.direction().length_squared();
+		const double inv_a = 1 / a;
+
+		uint32_t hit_index = UINT32_MAX;
+		double closest = ray_t.max;
+
+		bvh.traverse(r, ray_t.min, closest, [&](uint32_t first, uint32_t count) {
+			for (uint32_t base = first; base < first + count; base += lanes) {
+				// Test a full group of lanes at once. Lanes past the end of the leaf hold
+				// real spheres from the next leaf (or padding), which is extra work but never
+				// a wrong answer.
+				RT_STAT_ADD(STAT_SPHERE_SET_TESTS, lanes);
+				const float* px = &cx[base];
+				const float* py = &cy[base];
+				const float* pz = &cz[base];
+				const float* pr = &radii[base];
+				const double t_min = ray_t.min, t_max = closest;
+				double t_lane[lanes];
+
+				#pragma omp simd
+				for (int k = 0; k < lanes; k++) {
+					double ocx = px[k] - ox, ocy = py[k] - oy, ocz = pz[k] - oz;
+					double radius = pr[k];
+					double h = dx * ocx + dy * ocy + dz * ocz;
+					double c = ocx * ocx + ocy * ocy + ocz * ocz - radius * radius;
+					double discriminant = h * h - a * c;
+					double sqrtd = std::sqrt(discriminant > 0 ? discriminant : 0);
+					double root = (h - sqrtd) * inv_a;
+					if (!(root > t_min && root < t_max)) root = (h + sqrtd) * inv_a;
+					t_lane[k] = (discriminant >= 0 && root > t_min && root < t_max) ? root : infinity;
+				}
+
+				for (int k = 0; k < lanes; k++) {
+					if (t_lane[k] < closest) {
+						closest = t_lane[k];
+						hit_index = base + k;
+					}
+				}
+			}
+		});
+
+		if (hit_index == UINT32_MAX) return false;
+
+		point3 center(cx[hit_index], cy[hit_index], cz[hit_index]);
+		rec.t = closest;
+		rec.p = r.at(closest);
+		vec3 outward_normal = (rec.p - center) / radii[hit_index];
+		rec.set_face_normal(r, outward_normal);
+		sphere::get_sphere_uv(outward_normal, rec.u, rec.v);
+		sphere::get_sphere_derivatives(outward_normal, radii[hit_index], rec.dpdu, rec.dpdv);
+		rec.mat = materials[material_indices[hit_index]].get();
+		return true;
+	}
+
+	aabb bounding_box() const override { return bbox; }
+
+	size_t size() const { return padded ? cx.size() - (lanes - 1) : cx.size(); }
+
+	size_t memory_usage() const {
+		return sizeof(*this)
+			 + sizeof(float) * (cx.capacity() + cy.capacity() + cz.capacity() + radii.capacity())
+			 + sizeof(uint32_t) * material_indices.capacity()
+			 + sizeof(shared_ptr<material>) * materials.capacity()
+			 + bvh.memory_usage();
+	}
+
+private:
+	static const int lanes = 8;
+
+	std::vector<float> cx, cy, cz;
+	std::vector<float> radii;
+	std::vector<uint32_t> material_indices;
+	std::vector<shared_ptr<material>> materials;
+	std::unordered_map<const material*, uint32_t> material_lookup;	// Only used while adding
+	flat_bvh bvh;
+	aabb bbox;
+	bool padded = false;
+
+	void unbuild() {
+		// Drops the padding lanes and restores the material lookup that build() cleared.
+		for (auto* values : { &cx, &cy, &cz, &radii }) values->resize(values->size() - (lanes - 1));
+		material_indices.resize(material_indices.size() - (lanes - 1));
+		for (size_t i = 0; i < materials.size(); i++) material_lookup.emplace(materials[i].get(), uint32_t(i));
+		bvh = flat_bvh();
+		padded = false;
+	}
+
+	uint32_t material_index(const shared_ptr<material>& mat) {
+		auto found = material_lookup.find(mat.get());
+		if (found != material_lookup.end()) return found->second;
+		auto index = uint32_t(materials.size());
+		materials.push_back(mat);
+		material_lookup.emplace(mat.get(), index);
+		return index;
+	}
+
+	template <typename T>
+	static void permute(std::vector<T>& values, const std::vector<uint32_t>& order) {
+		// Leaves room for the padding lanes so that appending them does not reallocate.
+		std::vector<T> sorted;
+		sorted.reserve(order.size() + lanes - 1);
+		for (auto index : order) sorted.push_back(values[index]);
+		values.swap(sorted);
+	}
+};
+
+#endif // !SPHERE_SET_H
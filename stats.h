@@ -0,0 +1,135 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Hot-path counters: how many rays, node visits, primitive tests and scatters a render does.
+// They are compiled in only when RT_ENABLE_STATS is defined (the CMake option of the same
+// name); otherwise the RT_STAT macros expand to nothing. Each thread counts into a block of
+// its own, without atomics; stat_registry::totals() merges the blocks once rendering is done.
+
+enum stat_counter {
+	STAT_CAMERA_RAYS,
+	STAT_SHADOW_RAYS,			// Rays toward lights, cast to evaluate the light pdf
+	STAT_BVH_NODES,				// Nodes visited, of every BVH kind
+	STAT_AABB_TESTS,
+	STAT_LIST_TESTS,			// Children tested by hittable_list::hit
+	STAT_SPHERE_TESTS,
+	STAT_QUAD_TESTS,
+	STAT_BOX_TESTS,
+	STAT_TRIANGLE_TESTS,
+	STAT_SPHERE_SET_TESTS,		// Spheres of a sphere_set, tested a lane group at a time
+	STAT_INSTANCE_TESTS,		// Rays transformed into an instance, translate or rotate_y
+	STAT_LAMBERTIAN_SCATTERS,
+	STAT_METAL_SCATTERS,
+	STAT_DIELECTRIC_SCATTERS,
+	STAT_ISOTROPIC_SCATTERS,
+	STAT_MAX_DEPTH,				// Paths cut off by max_depth
+	STAT_COUNT
+};
+
+struct stat_block {
+	static const int max_path_length = 64;
+
+	uint64_t counts[STAT_COUNT] = {};
+	uint64_t path_lengths[max_path_length + 1] = {};	// Rays per camera sample; the last bucket holds longer paths
+
+	void record_path(uint64_t length) {
+		path_lengths[length < max_path_length ? length : max_path_length]++;
+	}
+
+	void add(const stat_block& other) {
+		for (int i = 0; i < STAT_COUNT; i++) counts[i] += other.counts[i];
+		for (int i = 0; i <= max_path_length; i++) path_lengths[i] += other.path_lengths[i];
+	}
+};
+
+class stat_registry {
+public:
+	static stat_block& local() {
+		// The calling thread's block, registered on its first use. Blocks outlive their
+		// threads, so counts of finished threads are kept.
+		static thread_local stat_block* block = nullptr;
+		if (!block) {
+			std::lock_guard<std::mutex> lock(mutex());
+			blocks().push_back(std::make_unique<stat_block>());
+			block = blocks().back().get();
+		}
+		return *block;
+	}
+
+	static void reset() {
+		// Not safe while other threads count.
+		std::lock_guard<std::mutex> lock(mutex());
+		for (auto& b : blocks()) *b = stat_block();
+	}
+
+	static stat_block totals() {
+		std::lock_guard<std::mutex> lock(mutex());
+		stat_block sum;
+		for (const auto& b : blocks()) sum.add(*b);
+		return sum;
+	}
+
+	static const char* name(int counter) {
+		static const char* names[STAT_COUNT] = {
+			"camera_rays", "shadow_rays", "bvh_nodes", "aabb_tests", "list_tests", "sphere_tests",
+			"quad_tests", "box_tests", "triangle_tests", "sphere_set_tests", "instance_tests",
+			"lambertian_scatters", "metal_scatters", "dielectric_scatters", "isotropic_scatters",
+			"max_depth_terminations"
+		};
+		return names[counter];
+	}
+
+	static void print(const stat_block& s, std::ostream& out) {
+		// A table of the non-zero counters, per camera ray, and the path length histogram.
+		auto camera_rays = s.counts[STAT_CAMERA_RAYS] ? double(s.counts[STAT_CAMERA_RAYS]) : 1.0;
+		out << "Counters (per camera ray):\n";
+		for (int i = 0; i < STAT_COUNT; i++) {
+			if (!s.counts[i]) continue;
+			out << "  " << name(i) << std::string(24 - std::string(name(i)).size(), ' ') << s.counts[i]
+				<< "  (" << s.counts[i] / camera_rays << ")\n";
+		}
+		out << "Path lengths:";
+		for (int i = 0; i <= stat_block::max_path_length; i++)
+			if (s.path_lengths[i])
+				out << ' ' << i << (i == stat_block::max_path_length ? "+" : "") << ':' << s.path_lengths[i];
+		out << '\n';
+	}
+
+	static void write_json(const stat_block& s, std::ostream& out) {
+		out << "{ ";
+		for (int i = 0; i < STAT_COUNT; i++) out << '"' << name(i) << "\": " << s.counts[i] << ", ";
+		out << "\"path_lengths\": [";
+		for (int i = 0; i <= stat_block::max_path_length; i++) out << (i ? ", " : "") << s.path_lengths[i];
+		out << "] }";
+	}
+
+private:
+	static std::mutex& mutex() {
+		static std::mutex m;
+		return m;
+	}
+
+	static std::vector<std::unique_ptr<stat_block>>& blocks() {
+		static std::vector<std::unique_ptr<stat_block>> b;
+		return b;
+	}
+};
+
+#ifdef RT_ENABLE_STATS
+#define RT_STAT(counter) (stat_registry::local().counts[counter]++)
+#define RT_STAT_ADD(counter, n) (stat_registry::local().counts[counter] += (n))
+#define RT_STAT_PATH(length) (stat_registry::local().record_path(length))
+#else
+#define RT_STAT(counter) ((void)0)
+#define RT_STAT_ADD(counter, n) ((void)0)
+#define RT_STAT_PATH(length) ((void)sizeof(length))
+#endif
+
+#endif // !STATS_H
@@ -1,13 +1,19 @@
 #ifndef TEXTURE_H
 #define TEXTURE_H
 
-#include "rtw_stb_image.h"
+#include "image_registry.h"
 #include "perlin.h"
 
 class texture {
 public:
 	virtual ~texture() = default;
 	virtual color value(double u, double v, const point3& p) const = 0;
+
+	// The value filtered over a footprint du by dv around (u, v), as given by
+	// hit_record::texture_footprint. Textures that do not filter ignore the footprint.
+	virtual color value(double u, double v, const point3& p, double du, double dv) const {
+		return value(u, v, p);
+	}
 };
 
 class solid_color : public texture {
@@ -17,6 +23,8 @@ public:
 	color value(double u, double v, const point3& p) const override {
 		return albedo;
 	}
+
+	friend class compiled_scene;
 private:
 	color albedo;
 };
@@ -37,6 +45,18 @@ public:
 
 		return iseven ? even->value(u, v, p) : odd->value(u, v, p);
 	}
+
+	color value(double u, double v, const point3& p, double du, double dv) const override {
+		auto xint = int(std::floor(inv_scale * p.x()));
+		auto yint = int(std::floor(inv_scale * p.y()));
+		auto zint = int(std::floor(inv_scale * p.z()));
+
+		bool iseven = (xint + yint + zint) % 2 == 0;
+
+		return iseven ? even->value(u, v, p, du, dv) : odd->value(u, v, p, du, dv);
+	}
+
+	friend class compiled_scene;
 private:
 	double inv_scale;
 	shared_ptr<texture> even;
@@ -46,26 +66,30 @@ private:
 
 class image_texture : public texture {
 public:
-	image_texture(const char* filename) : image(filename) {}
+	image_texture(const char* filename, texel_format format = texel_format::srgb8)
+		: image(image_registry::global().get(filename, format)) {}
+	image_texture(shared_ptr<const rtw_image> image) : image(image) {}
 
 	color value(double u, double v, const point3& p) const override {
+		return value(u, v, p, 0, 0);
+	}
+
+	color value(double u, double v, const point3& p, double du, double dv) const override {
 		// If we have no texture data, then return solid cyan as a debugging aid.
-		if (image.height() <= 0) return color(1, 1, 0);
+		if (image->height() <= 0) return color(1, 1, 0);
 
 		// Clamp input texture coordinates to [0,1] x [1,0]
 		u = interval(0, 1).clamp(u);
 		v = 1.0 - interval(0, 1).clamp(v);  // Flip V to image coordinates
 
-		auto i = int(u * image.width());
-		auto j = int(v * image.height());
-		auto pixel = image.pixel_data(i, j);
-
-		auto color_scale = 1.0 / 255.0;
-		return color(color_scale * pixel[0], color_scale * pixel[1], color_scale * pixel[2]);
+		// Pick the MIP level whose texels are as large as the longer side of the footprint.
+		auto texels = std::fmax(du * image->width(), dv * image->height());
+		auto lod = texels > 1 ? std::log2(texels) : 0.0;
+		return image->trilinear(u, v, lod);
 	}
 
 private:
-	rtw_image image;
+	shared_ptr<const rtw_image> image;	// Shared with every texture using the same file
 };
 
 class noise_texture : public texture {
@@ -74,12 +98,21 @@ public:
 
 	color value(double u, double v, const point3& p) const override {
 		//return color(1, 1, 1) * noise.turb(scale * p, octave);
-		return color(.5, .5, .5) * (1 + std::sin(scale * p.z() + 10 * noise.turb(p, octave)));
+		auto turbulence = baked && baked->contains(p) ? baked->value(p) : noise.turb(p, octave);
+		return color(.5, .5, .5) * (1 + std::sin(scale * p.z() + 10 * turbulence));
+	}
+
+	void bake(const point3& min, const point3& max, int resolution) {
+		// Looks the turbulence up in a precomputed volume over the box from now on, which is
+		// faster but blurs detail finer than a cell. Points outside the box use exact noise.
+		baked = std::make_unique<turbulence_volume>(noise, octave, min, max, resolution);
 	}
+
 private:
 	perlin noise;
 	double scale;
 	int octave;
+	std::unique_ptr<turbulence_volume> baked;
 };
 
 #endif
\ No newline at end of file
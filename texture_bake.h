@@ -0,0 +1,80 @@
+#ifndef TEXTURE_BAKE_H
+#define TEXTURE_BAKE_H
+
+#include "texture.h"
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <vector>
+
+// A cache of procedural textures, for static scenes where a texture returns the same value at
+// a point every sample. It interpolates between cached samples, so it blurs detail finer than
+// its resolution and softens hard edges such as a checker's. For noise in a volume, see
+// noise_texture::bake.
+
+class uv_atlas_texture : public texture {
+public:
+	// The source texture evaluated once per texel over the uv square of one surface, given by
+	// the point of the surface at each (u, v). Only valid on that surface.
+	uv_atlas_texture(shared_ptr<texture> source, std::function<point3(double, double)> surface_point,
+					 int width, int height)
+		: width(std::max(width, 1)), height(std::max(height, 1)), texels(size_t(3) * this->width * this->height)
+	{
+		auto start = std::chrono::steady_clock::now();
+		#pragma omp parallel for schedule(dynamic)
+		for (int y = 0; y < this->height; y++) {
+			for (int x = 0; x < this->width; x++) {
+				auto u = (x + 0.5) / this->width, v = (y + 0.5) / this->height;
+				auto c = source->value(u, v, surface_point(u, v));
+				for (int k = 0; k < 3; k++) texels[3 * (size_t(y) * this->width + x) + k] = float(c[k]);
+			}
+		}
+		auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+		std::clog << "Baked uv atlas: " << this->width << 'x' << this->height << " in " << elapsed.count()
+				  << " ms, " << memory_usage() / 1024 << " KB\n";
+	}
+
+	static shared_ptr<uv_atlas_texture> for_sphere(shared_ptr<texture> source, const point3& center,
+												   double radius, int width) {
+		// Inverts sphere::get_sphere_uv: u is the angle around the Y axis from X=-1, v the angle
+		// from Y=-1.
+		auto surface_point = [center, radius](double u, double v) {
+			auto theta = v * pi, phi = 2 * pi * u;
+			auto n = vec3(-std::sin(theta) * std::cos(phi), -std::cos(theta), std::sin(theta) * std::sin(phi));
+			return center + radius * n;
+		};
+		return make_shared<uv_atlas_texture>(source, surface_point, width, std::max(1, width / 2));
+	}
+
+	static shared_ptr<uv_atlas_texture> for_quad(shared_ptr<texture> source, const point3& Q, const vec3& u,
+												 const vec3& v, int width, int height) {
+		auto surface_point = [Q, u, v](double a, double b) { return Q + a * u + b * v; };
+		return make_shared<uv_atlas_texture>(source, surface_point, width, height);
+	}
+
+	color value(double u, double v, const point3& p) const override {
+		// Bilinear between texel centers, clamped at the edges.
+		auto s = interval(0, 1).clamp(u) * width - 0.5, t = interval(0, 1).clamp(v) * height - 0.5;
+		auto x = int(std::floor(s)), y = int(std::floor(t));
+		auto fx = s - x, fy = t - y;
+		return (1 - fy) * ((1 - fx) * texel(x, y)     + fx * texel(x + 1, y))
+			 +      fy  * ((1 - fx) * texel(x, y + 1) + fx * texel(x + 1, y + 1));
+	}
+
+	size_t memory_usage() const { return texels.capacity() * sizeof(float); }
+
+private:
+	int width, height;
+	std::vector<float> texels;	// Linear RGB, row by row
+
+	color texel(int x, int y) const {
+		x = std::clamp(x, 0, width - 1);
+		y = std::clamp(y, 0, height - 1);
+		const float* t = &texels[3 * (size_t(y) * width + x)];
+		return color(t[0], t[1], t[2]);
+	}
+};
+
+#endif // !TEXTURE_BAKE_H
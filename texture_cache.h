@@ -0,0 +1,392 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include "image_registry.h"
+#include "texture.h"
+
+#include <array>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class texture_cache {
+public:
+	// Serves texels of images too large to keep in memory. Each image is converted once into a
+	// tiled file (64x64 texel tiles of every MIP level, in the requested texel format) in the
+	// cache directory, and tiles are read from it the first time a lookup touches them. Read
+	// tiles stay in memory until the cache exceeds its budget, when the least recently used
+	// ones are evicted. Each thread also keeps its last few tiles in a small front cache that
+	// needs no locking; tiles evicted meanwhile stay alive until a front cache lets go of them,
+	// so memory can exceed the budget by up to that many tiles per thread.
+
+	static const int tile_size = 64;
+
+	static texture_cache& global() {
+		static texture_cache cache;
+		return cache;
+	}
+
+	texture_cache() {
+		// If the RTW_TEXTURE_CACHE environment variable is defined, keep the tiled files there;
+		// otherwise in a directory under the system's temporary directory.
+		if (auto directory = getenv("RTW_TEXTURE_CACHE"))
+			cache_directory = directory;
+		else
+			cache_directory = (std::filesystem::temp_directory_path() / "rtw_texture_cache").string();
+	}
+
+	texture_cache(const texture_cache&) = delete;
+	texture_cache& operator=(const texture_cache&) = delete;
+
+	void set_budget(size_t bytes) {
+		// Evicts down to the new budget at the next tile read.
+		std::lock_guard<std::mutex> lock(mutex);
+		budget = bytes;
+	}
+
+	void set_directory(std::string directory) {
+		// Affects images opened after the call.
+		std::lock_guard<std::mutex> lock(mutex);
+		cache_directory = std::move(directory);
+	}
+
+	int open(const std::string& filename, texel_format format = texel_format::srgb8) {
+		// Returns the id of the image's tiled file, converting the image if the file is missing
+		// or older than the image, or -1 if the image cannot be found or converted. Open every
+		// image before rendering starts; lookups do not lock the list of open files.
+		std::lock_guard<std::mutex> open_lock(open_mutex);
+		std::string directory;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			directory = cache_directory;
+		}
+
+		auto source = image_registry::global().find(filename);
+		if (source.empty()) {
+			std::cerr << "ERROR: Could not load image file '" << filename << "'.\n";
+			return -1;
+		}
+
+		auto tiled = std::filesystem::path(directory) / tiled_name(source, format);
+		std::error_code error;
+		bool fresh = std::filesystem::exists(tiled, error)
+				  && std::filesystem::last_write_time(tiled, error) >= std::filesystem::last_write_time(source, error);
+
+		auto file = std::make_unique<tiled_file>();
+		if (!(fresh && read_header(tiled.string(), *file))) {
+			if (!convert(source, tiled, format) || !read_header(tiled.string(), *file)) {
+				std::cerr << "ERROR: Could not write tiled texture '" << tiled.string() << "'.\n";
+				return -1;
+			}
+		}
+
+		if (files.size() >= max_files) {
+			std::cerr << "ERROR: Too many tiled textures open.\n";
+			return -1;
+		}
+		files.push_back(std::move(file));
+		return int(files.size() - 1);
+	}
+
+	int width(int file, int level = 0) const { return files[file]->levels[level].width; }
+	int height(int file, int level = 0) const { return files[file]->levels[level].height; }
+	int level_count(int file) const { return int(files[file]->levels.size()); }
+
+	color texel(int file, int level, int x, int y) {
+		// Linear color of texel x,y of a MIP level, clamped to the level.
+		const auto& f = *files[file];
+		const auto& l = f.levels[level];
+		x = x < 0 ? 0 : x < l.width ? x : l.width - 1;
+		y = y < 0 ? 0 : y < l.height ? y : l.height - 1;
+
+		auto key = tile_key(file, level, x / tile_size, y / tile_size);
+		const auto& t = find_tile(key);
+		size_t within = size_t(y % tile_size) * tile_size + x % tile_size;
+		return rtw_image::decode(&t.texels[within * f.bytes_per_texel], f.format);
+	}
+
+	color trilinear(int file, double s, double t, double lod) {
+		// As rtw_image::trilinear, over the cached tiles.
+		int last = level_count(file) - 1;
+		auto level_bilinear = [&](int level) {
+			return rtw_image::bilinear_filter([&](int x, int y) { return texel(file, level, x, y); },
+											  s * width(file, level), t * height(file, level));
+		};
+		if (!(lod > 0)) return level_bilinear(0);
+		if (lod >= last) return level_bilinear(last);
+
+		int level = int(lod);
+		double f = lod - level;
+		return (1 - f) * level_bilinear(level) + f * level_bilinear(level + 1);
+	}
+
+	void report(std::ostream& out) const {
+		// Front cache hits are counted in batches per thread, so the latest few may be missing.
+		std::lock_guard<std::mutex> lock(mutex);
+		out << "Texture cache: " << front_hits.load() << " front hits, " << hits.load() << " hits, "
+			<< misses.load() << " misses, " << evictions.load() << " evictions; "
+			<< bytes_read.load() / 1024 << " KB read, " << resident_bytes / 1024 << " of "
+			<< budget / 1024 << " KB resident\n";
+	}
+
+private:
+	struct level_info {
+		int width, height;
+		int tiles_x, tiles_y;
+		uint64_t offset;	// Start of the level's tiles in the file
+	};
+
+	struct tiled_file {
+		std::vector<level_info> levels;
+		texel_format format;
+		int bytes_per_texel;
+		std::ifstream stream;
+		std::mutex io;	// Guards the stream position
+	};
+
+	struct tile {
+		std::vector<unsigned char> texels;	// tile_size x tile_size, row by row
+	};
+
+	struct lru_entry {
+		shared_ptr<const tile> data;
+		std::list<uint64_t>::iterator position;
+	};
+
+	struct front_cache {
+		static const int size = 16;
+		struct slot { uint64_t owner = 0, key = 0; shared_ptr<const tile> data; };
+		std::array<slot, size> slots;
+		size_t pending_hits = 0;
+	};
+
+	// Tiled file layout: the header, then the level table, then the tiles of each level, row
+	// by row. Edge tiles are padded to the full tile size.
+	static constexpr char magic[4] = { 'R', 'T', 'W', 'T' };
+	static const uint32_t version = 1;
+	static const size_t max_files = 1 << 16;
+
+	std::vector<std::unique_ptr<tiled_file>> files;
+	std::string cache_directory;
+	std::mutex open_mutex;
+
+	mutable std::mutex mutex;	// Guards the tile table, the LRU list and the budget
+	std::unordered_map<uint64_t, lru_entry> tiles;
+	std::list<uint64_t> lru;	// Most recently used first
+	size_t resident_bytes = 0;
+	size_t budget = size_t(256) << 20;
+
+	uint64_t id = next_id();	// Tells the front cache entries of different caches apart
+	std::atomic<size_t> front_hits{ 0 }, hits{ 0 }, misses{ 0 }, evictions{ 0 }, bytes_read{ 0 };
+
+	static uint64_t next_id() {
+		static std::atomic<uint64_t> next{ 1 };
+		return next++;
+	}
+
+	static uint64_t tile_key(int file, int level, int tx, int ty) {
+		return (uint64_t(file) << 48) | (uint64_t(level) << 40) | (uint64_t(ty) << 20) | uint64_t(tx);
+	}
+
+	const tile& find_tile(uint64_t key) {
+		static thread_local front_cache front;
+		auto& slot = front.slots[(key ^ (key >> 20) ^ (key >> 40)) % front_cache::size];
+		if (slot.owner == id && slot.key == key) {
+			if (++front.pending_hits == 4096) {
+				front_hits += front.pending_hits;
+				front.pending_hits = 0;
+			}
+			return *slot.data;
+		}
+
+		slot.owner = id;
+		slot.key = key;
+		slot.data = shared_tile(key);
+		return *slot.data;
+	}
+
+	shared_ptr<const tile> shared_tile(uint64_t key) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			auto found = tiles.find(key);
+			if (found != tiles.end()) {
+				lru.splice(lru.begin(), lru, found->second.position);
+				hits++;
+				return found->second.data;
+			}
+		}
+
+		// Read without holding the table lock, so other threads keep hitting resident tiles.
+		auto data = read_tile(key);
+		misses++;
+
+		std::lock_guard<std::mutex> lock(mutex);
+		auto found = tiles.find(key);
+		if (found != tiles.end()) return found->second.data;	// Another thread read it first
+
+		lru.push_front(key);
+		tiles.emplace(key, lru_entry{ data, lru.begin() });
+		resident_bytes += data->texels.size();
+		while (resident_bytes > budget && lru.size() > 1) {
+			auto victim = tiles.find(lru.back());
+			resident_bytes -= victim->second.data->texels.size();
+			tiles.erase(victim);
+			lru.pop_back();
+			evictions++;
+		}
+		return data;
+	}
+
+	shared_ptr<const tile> read_tile(uint64_t key) {
+		trace_scope scope("read tile", "texture", "level", int64_t((key >> 40) & 0xff));
+		auto& f = *files[key >> 48];
+		const auto& l = f.levels[(key >> 40) & 0xff];
+		auto ty = (key >> 20) & 0xfffff, tx = key & 0xfffff;
+
+		auto result = make_shared<tile>();
+		size_t tile_bytes = size_t(tile_size) * tile_size * f.bytes_per_texel;
+		result->texels.resize(tile_bytes);
+
+		std::lock_guard<std::mutex> lock(f.io);
+		auto offset = l.offset + (ty * l.tiles_x + tx) * tile_bytes;
+		f.stream.clear();
+		f.stream.seekg(std::streamoff(offset));
+		if (!f.stream.read(reinterpret_cast<char*>(result->texels.data()), std::streamsize(tile_bytes)))
+			std::cerr << "ERROR: Could not read tile of tiled texture.\n";
+		bytes_read += tile_bytes;
+		return result;
+	}
+
+	static std::string tiled_name(const std::string& source, texel_format format) {
+		// The image's file name, for people looking at the cache, plus a hash of its full path,
+		// so that images of the same name in different directories get files of their own.
+		std::error_code error;
+		auto full = std::filesystem::weakly_canonical(source, error);
+		auto path = error ? std::filesystem::absolute(source, error).string() : full.string();
+		uint64_t hash = 14695981039346656037ull;	// FNV-1a, stable across runs and platforms
+		for (unsigned char c : path) hash = (hash ^ c) * 1099511628211ull;
+
+		char digits[17];
+		std::snprintf(digits, sizeof(digits), "%016llx", (unsigned long long)hash);
+		return std::filesystem::path(source).filename().string() + '.' + digits + '.'
+			 + rtw_image::format_name(format) + ".rtwt";
+	}
+
+	static bool convert(const std::string& source, const std::filesystem::path& tiled, texel_format format) {
+		// Decodes the image (with its MIP pyramid) once and writes it out tile by tile. The file
+		// is written under a temporary name and renamed, so a partial file is never used.
+		trace_scope scope("convert to tiles", "texture");
+		rtw_image image;
+		if (!image.load(source, format)) return false;
+
+		std::error_code error;
+		std::filesystem::create_directories(tiled.parent_path(), error);
+		auto temporary = tiled.string() + ".tmp";
+		std::ofstream out(temporary, std::ios::binary);
+		if (!out) return false;
+		auto write = [&](const void* bytes, size_t size) {
+			out.write(static_cast<const char*>(bytes), std::streamsize(size));
+		};
+
+		uint32_t header[4] = { version, uint32_t(image.format()), uint32_t(image.levels.size()), tile_size };
+		write(magic, sizeof(magic));
+		write(header, sizeof(header));
+
+		std::vector<level_info> levels;
+		uint64_t offset = sizeof(magic) + sizeof(header) + image.levels.size() * sizeof(level_info);
+		size_t tile_bytes = size_t(tile_size) * tile_size * image.bytes_per_texel;
+		for (const auto& l : image.levels) {
+			level_info info{ l.width, l.height, (l.width + tile_size - 1) / tile_size, (l.height + tile_size - 1) / tile_size, offset };
+			offset += uint64_t(info.tiles_x) * info.tiles_y * tile_bytes;
+			levels.push_back(info);
+		}
+		write(levels.data(), levels.size() * sizeof(level_info));
+
+		std::vector<unsigned char> buffer(tile_bytes);
+		for (size_t level = 0; level < levels.size() && out; level++) {
+			const auto& info = levels[level];
+			for (int ty = 0; ty < info.tiles_y && out; ty++) {
+				for (int tx = 0; tx < info.tiles_x && out; tx++) {
+					std::fill(buffer.begin(), buffer.end(), 0);
+					for (int y = 0; y < tile_size && ty * tile_size + y < info.height; y++) {
+						for (int x = 0; x < tile_size && tx * tile_size + x < info.width; x++) {
+							auto from = image.texel_offset(image.levels[level], tx * tile_size + x, ty * tile_size + y);
+							std::memcpy(&buffer[(size_t(y) * tile_size + x) * image.bytes_per_texel],
+										&image.data[from], image.bytes_per_texel);
+						}
+					}
+					write(buffer.data(), tile_bytes);
+				}
+			}
+		}
+
+		out.close();
+		bool ok = bool(out);
+		if (ok) std::filesystem::rename(temporary, tiled, error);
+		if (!ok || error) {
+			std::filesystem::remove(temporary, error);
+			return false;
+		}
+		std::clog << "Converted '" << source << "' to tiled texture '" << tiled.string() << "'\n";
+		return true;
+	}
+
+	static bool read_header(const std::string& path, tiled_file& file) {
+		file.stream.close();
+		file.stream.clear();
+		file.stream.open(path, std::ios::binary);
+		auto read = [&](void* bytes, size_t size) {
+			return bool(file.stream.read(static_cast<char*>(bytes), std::streamsize(size)));
+		};
+
+		char file_magic[4];
+		uint32_t header[4];
+		if (!read(file_magic, sizeof(file_magic)) || std::memcmp(file_magic, magic, sizeof(magic)) != 0
+			|| !read(header, sizeof(header))
+			|| header[0] != version || header[2] == 0 || header[2] > 32 || header[3] != tile_size)
+			return false;
+
+		file.format = texel_format(header[1]);
+		file.bytes_per_texel = rtw_image::bytes_per_texel_of(file.format);
+		file.levels.resize(header[2]);
+		return read(file.levels.data(), file.levels.size() * sizeof(level_info));
+	}
+};
+
+class cached_image_texture : public texture {
+public:
+	// An image texture read through a texture_cache rather than loaded whole.
+	cached_image_texture(const char* filename, texel_format format = texel_format::srgb8,
+						 texture_cache& cache = texture_cache::global())
+		: cache(cache), file(cache.open(filename, format)) {}
+
+	color value(double u, double v, const point3& p) const override {
+		return value(u, v, p, 0, 0);
+	}
+
+	color value(double u, double v, const point3& p, double du, double dv) const override {
+		// As image_texture::value.
+		if (file < 0) return color(1, 1, 0);
+
+		u = interval(0, 1).clamp(u);
+		v = 1.0 - interval(0, 1).clamp(v);
+
+		auto texels = std::fmax(du * cache.width(file), dv * cache.height(file));
+		auto lod = texels > 1 ? std::log2(texels) : 0.0;
+		return cache.trilinear(file, u, v, lod);
+	}
+
+private:
+	texture_cache& cache;
+	int file;
+};
+
+#endif // !TEXTURE_CACHE_H
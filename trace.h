@@ -0,0 +1,168 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// A timeline of what each thread did during a run, written as Chrome trace JSON for
+// ui.perfetto.dev or chrome://tracing. Code marks its phases with trace_scope; while no trace
+// is running, a scope costs one relaxed load. Each thread records into a ring buffer of its own,
+// without locks, keeping the most recent events if it fills up.
+
+struct trace_event {
+	const char* name;
+	const char* category;
+	const char* arg_name;		// Null if the event has no argument
+	int64_t arg;
+	uint64_t start_ns, end_ns;	// Since the trace was started
+};
+
+struct trace_buffer {
+	int thread_index;
+	std::vector<trace_event> events;	// Ring of recent events
+	std::atomic<uint64_t> written{0};	// Events ever recorded; only the owning thread adds to it
+};
+
+class tracer {
+public:
+	static void start(size_t events_per_thread = 1 << 16) {
+		// Begins a trace, discarding the events of any earlier one. Not safe while other
+		// threads record.
+		std::lock_guard<std::mutex> lock(mutex());
+		capacity() = events_per_thread > 0 ? events_per_thread : 1;
+		for (auto& b : buffers()) {
+			b->events.assign(capacity(), trace_event());
+			b->written = 0;
+		}
+		epoch() = std::chrono::steady_clock::now();
+		enabled_flag().store(true, std::memory_order_relaxed);
+	}
+
+	static void stop() { enabled_flag().store(false, std::memory_order_relaxed); }
+
+	static bool enabled() { return enabled_flag().load(std::memory_order_relaxed); }
+
+	static uint64_t now() {
+		return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now() - epoch()).count());
+	}
+
+	static void record(const trace_event& event) {
+		auto& b = local();
+		auto n = b.written.load(std::memory_order_relaxed);
+		b.events[n % b.events.size()] = event;
+		b.written.store(n + 1, std::memory_order_release);
+	}
+
+	static bool write(const std::string& path) {
+		// Writes the events recorded so far, which should be once the traced threads are idle.
+		std::ofstream out(path);
+		write(out);
+		if (!out) {
+			std::cerr << "ERROR: Could not write trace '" << path << "'.\n";
+			return false;
+		}
+		return true;
+	}
+
+	static void write(std::ostream& out) {
+		std::lock_guard<std::mutex> lock(mutex());
+		out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+		bool first = true;
+		size_t dropped = 0;
+		for (const auto& b : buffers()) {
+			auto written = b->written.load(std::memory_order_acquire);
+			if (written == 0) continue;
+			out << (first ? "" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": "
+				<< b->thread_index << ", \"args\": {\"name\": \"thread " << b->thread_index << "\"}}";
+			first = false;
+			auto size = b->events.size();
+			auto begin = written > size ? written - size : 0;
+			dropped += size_t(begin);
+			for (auto n = begin; n < written; n++) {
+				const auto& e = b->events[n % size];
+				out << ",\n{\"name\": \"" << e.name << "\", \"cat\": \"" << e.category
+					<< "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << b->thread_index
+					<< ", \"ts\": " << e.start_ns / 1000.0 << ", \"dur\": " << (e.end_ns - e.start_ns) / 1000.0;
+				if (e.arg_name) out << ", \"args\": {\"" << e.arg_name << "\": " << e.arg << '}';
+				out << '}';
+			}
+		}
+		out << "\n]}\n";
+		if (dropped)
+			std::cerr << "Trace: " << dropped << " early events were overwritten; raise the per-thread capacity.\n";
+	}
+
+private:
+	static trace_buffer& local() {
+		// The calling thread's buffer, registered on its first event. Buffers outlive their
+		// threads, so events of finished threads are kept.
+		static thread_local trace_buffer* buffer = nullptr;
+		if (!buffer) {
+			std::lock_guard<std::mutex> lock(mutex());
+			buffers().push_back(std::make_unique<trace_buffer>());
+			buffer = buffers().back().get();
+			buffer->thread_index = int(buffers().size()) - 1;
+			buffer->events.assign(capacity(), trace_event());
+		}
+		return *buffer;
+	}
+
+	static std::atomic<bool>& enabled_flag() {
+		static std::atomic<bool> flag{false};
+		return flag;
+	}
+
+	static size_t& capacity() {
+		static size_t c = 1 << 16;
+		return c;
+	}
+
+	static std::chrono::steady_clock::time_point& epoch() {
+		static auto t = std::chrono::steady_clock::now();
+		return t;
+	}
+
+	static std::mutex& mutex() {
+		static std::mutex m;
+		return m;
+	}
+
+	static std::vector<std::unique_ptr<trace_buffer>>& buffers() {
+		static std::vector<std::unique_ptr<trace_buffer>> b;
+		return b;
+	}
+};
+
+class trace_scope {
+public:
+	// Records the span from construction to destruction as one event, if a trace is running.
+	// The strings must outlive the trace; literals are expected.
+	trace_scope(const char* name, const char* category, const char* arg_name = nullptr, int64_t arg = 0)
+		: active(tracer::enabled()) {
+		if (!active) return;
+		event = { name, category, arg_name, arg, tracer::now(), 0 };
+	}
+
+	~trace_scope() {
+		if (!active) return;
+		event.end_ns = tracer::now();
+		tracer::record(event);
+	}
+
+	trace_scope(const trace_scope&) = delete;
+	trace_scope& operator=(const trace_scope&) = delete;
+
+private:
+	bool active;
+	trace_event event;
+};
+
+#endif // !TRACE_H
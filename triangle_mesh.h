@@ -0,0 +1,206 @@
+#ifndef TRIANGLE_MESH_H
+#define TRIANGLE_MESH_H
+
+#include "flat_bvh.h"
+#include "hittable.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+class mesh_data {
+public:
+	std::vector<float> positions;			// xyz per vertex
+	std::vector<float> normals;				// xyz per vertex normal, optional
+	std::vector<float> uvs;					// uv per texture coordinate, optional
+	std::vector<uint32_t> indices;			// Three position indices per triangle
+	std::vector<uint32_t> normal_indices;	// Per-corner normal indices; empty reuses `indices`
+	std::vector<uint32_t> uv_indices;		// Per-corner uv indices; empty reuses `indices`
+
+	size_t triangle_count() const { return indices.size() / 3; }
+
+	size_t memory_usage() const {
+		return sizeof(float) * (positions.capacity() + normals.capacity() + uvs.capacity())
+			 + sizeof(uint32_t) * (indices.capacity() + normal_indices.capacity() + uv_indices.capacity());
+	}
+};
+
+class triangle_mesh : public hittable {
+public:
+	// Builds a BVH over the triangles of `data`. The triangle order in the index buffers is
+	// permuted so that every BVH leaf references a contiguous run of triangles.
+	triangle_mesh(mesh_data data, shared_ptr<material> mat) : mesh(std::move(data)), mat(mat) {
+		build_bvh();
+	}
+
+	bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+		// Per-ray setup for the watertight test: permute the axes so that the dominant
+		// direction component becomes z, and shear the ray onto the z axis.
+		const vec3& dir = r.direction();
+		int kz = std::fabs(dir.x()) > std::fabs(dir.y())
+			? (std::fabs(dir.x()) > std::fabs(dir.z()) ? 0 : 2)
+			: (std::fabs(dir.y()) > std::fabs(dir.z()) ? 1 : 2);
+		int kx = (kz + 1) % 3;
+		int ky = (kx + 1) % 3;
+		if (dir[kz] < 0) std::swap(kx, ky);
+		shear s{ kx, ky, kz, dir[kx] / dir[kz], dir[ky] / dir[kz], 1.0 / dir[kz] };
+
+		uint32_t hit_triangle = UINT32_MAX;
+		double closest = ray_t.max, hit_b1 = 0, hit_b2 = 0;
+
+		bvh.traverse(r, ray_t.min, closest, [&](uint32_t first, uint32_t count) {
+			RT_STAT_ADD(STAT_TRIANGLE_TESTS, count);
+			for (uint32_t tri = first; tri < first + count; tri++) {
+				double t, b1, b2;
+				if (intersect(tri, r.origin(), s, interval(ray_t.min, closest), t, b1, b2)) {
+					closest = t;
+					hit_triangle = tri;
+					hit_b1 = b1;
+					hit_b2 = b2;
+				}
+			}
+		});
+
+		if (hit_triangle == UINT32_MAX) return false;
+		fill_record(r, hit_triangle, closest, hit_b1, hit_b2, rec);
+		return true;
+	}
+
+	aabb bounding_box() const override { return bbox; }
+
+	size_t triangle_count() const { return mesh.triangle_count(); }
+
+	size_t memory_usage() const {
+		return sizeof(*this) + mesh.memory_usage() + bvh.memory_usage();
+	}
+
+private:
+	struct shear {
+		int kx, ky, kz;
+		double sx, sy, sz;
+	};
+
+	static const int max_leaf_size = 4;
+
+	mesh_data mesh;
+	shared_ptr<material> mat;
+	flat_bvh bvh;
+	aabb bbox;
+
+	point3 vertex(uint32_t index) const {
+		const float* p = &mesh.positions[3 * size_t(index)];
+		return point3(p[0], p[1], p[2]);
+	}
+
+	bool intersect(uint32_t tri, const point3& org, const shear& s, interval ray_t,
+		double& t, double& b1, double& b2) const {
+		// Watertight ray/triangle test (Woop, Benthin and Wald 2013): edges shared by two
+		// triangles are resolved consistently, so rays cannot slip through mesh seams.
+		auto a = vertex(mesh.indices[3 * size_t(tri)]) - org;
+		auto b = vertex(mesh.indices[3 * size_t(tri) + 1]) - org;
+		auto c = vertex(mesh.indices[3 * size_t(tri) + 2]) - org;
+
+		double ax = a[s.kx] - s.sx * a[s.kz], ay = a[s.ky] - s.sy * a[s.kz];
+		double bx = b[s.kx] - s.sx * b[s.kz], by = b[s.ky] - s.sy * b[s.kz];
+		double cx = c[s.kx] - s.sx * c[s.kz], cy = c[s.ky] - s.sy * c[s.kz];
+
+		double u = cx * by - cy * bx;
+		double v = ax * cy - ay * cx;
+		double w = bx * ay - by * ax;
+
+		if ((u < 0 || v < 0 || w < 0) && (u > 0 || v > 0 || w > 0)) return false;
+
+		double det = u + v + w;
+		if (det == 0) return false;
+
+		double t_scaled = s.sz * (u * a[s.kz] + v * b[s.kz] + w * c[s.kz]);
+		t = t_scaled / det;
+		if (!ray_t.surrounds(t)) return false;
+
+		b1 = v / det;
+		b2 = w / det;
+		return true;
+	}
+
+	void fill_record(const ray& r, uint32_t tri, double t, double b1, double b2, hit_record& rec) const {
+		size_t corner = 3 * size_t(tri);
+		auto p0 = vertex(mesh.indices[corner]);
+		auto p1 = vertex(mesh.indices[corner + 1]);
+		auto p2 = vertex(mesh.indices[corner + 2]);
+		double b0 = 1 - b1 - b2;
+
+		rec.t = t;
+		rec.p = r.at(t);
+		rec.mat = mat.get();
+
+		vec3 outward_normal = unit_vector(cross(p1 - p0, p2 - p0));
+		if (!mesh.normals.empty()) {
+			const auto& ni = mesh.normal_indices.empty() ? mesh.indices : mesh.normal_indices;
+			vec3 shading(0, 0, 0);
+			double weights[3] = { b0, b1, b2 };
+			for (int k = 0; k < 3; k++) {
+				const float* n = &mesh.normals[3 * size_t(ni[corner + k])];
+				shading += weights[k] * vec3(n[0], n[1], n[2]);
+			}
+			if (shading.length_squared() > 0) outward_normal = unit_vector(shading);
+		}
+		rec.set_face_normal(r, outward_normal);
+
+		if (!mesh.uvs.empty()) {
+			const auto& ti = mesh.uv_indices.empty() ? mesh.indices : mesh.uv_indices;
+			const float* t0 = &mesh.uvs[2 * size_t(ti[corner])];
+			const float* t1 = &mesh.uvs[2 * size_t(ti[corner + 1])];
+			const float* t2 = &mesh.uvs[2 * size_t(ti[corner + 2])];
+			rec.u = b0 * t0[0] + b1 * t1[0] + b2 * t2[0];
+			rec.v = b0 * t0[1] + b1 * t1[1] + b2 * t2[1];
+
+			// Solve p0 - p2 and p1 - p2 in terms of the uv differences; degenerate uvs leave the
+			// derivatives unknown.
+			double du02 = t0[0] - t2[0], dv02 = t0[1] - t2[1];
+			double du12 = t1[0] - t2[0], dv12 = t1[1] - t2[1];
+			double det = du02 * dv12 - dv02 * du12;
+			if (det != 0) {
+				rec.dpdu = (dv12 * (p0 - p2) - dv02 * (p1 - p2)) / det;
+				rec.dpdv = (du02 * (p1 - p2) - du12 * (p0 - p2)) / det;
+			}
+			else {
+				rec.dpdu = rec.dpdv = vec3(0, 0, 0);
+			}
+		}
+		else {
+			rec.u = b1;
+			rec.v = b2;
+			rec.dpdu = p1 - p0;
+			rec.dpdv = p2 - p0;
+		}
+	}
+
+	void build_bvh() {
+		auto n = triangle_count();
+		std::vector<flat_bvh::build_prim> prims(n);
+		for (size_t tri = 0; tri < n; tri++) {
+			for (int k = 0; k < 3; k++)
+				prims[tri].bounds.grow(&mesh.positions[3 * size_t(mesh.indices[3 * tri + k])]);
+			prims[tri].index = uint32_t(tri);
+		}
+		reorder_triangles(bvh.build(std::move(prims), max_leaf_size));
+		bbox = bvh.bounding_box();
+	}
+
+	void reorder_triangles(const std::vector<uint32_t>& order) {
+		auto permute = [&](std::vector<uint32_t>& buffer) {
+			if (buffer.empty()) return;
+			std::vector<uint32_t> sorted(buffer.size());
+			for (size_t i = 0; i < order.size(); i++) {
+				for (int k = 0; k < 3; k++)
+					sorted[3 * i + k] = buffer[3 * size_t(order[i]) + k];
+			}
+			buffer.swap(sorted);
+		};
+		permute(mesh.indices);
+		permute(mesh.normal_indices);
+		permute(mesh.uv_indices);
+	}
+};
+
+#endif // !TRIANGLE_MESH_H